@@ -1,5 +1,5 @@
 /// HEADER - ENCRYPTION
-/** Header file for an AES-CTR 256-bit key implementation. */
+/** Header file for an AES-CTR implementation with keys of 128 to 256 bits. */
 #ifndef __AESCTR_H__
 #define __AESCTR_H__
 
@@ -7,12 +7,30 @@
 
 // ------ INCLUDES ------ //
 
+#include "basics.h"
+#include <stdlib.h>
+#include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 //_____________________________________________________________________________
 
+// ------ MACROS ------ //
+
+/** Number of rounds of the block cipher with a key of the given bytes. */
+#ifndef AES_ROUNDS
+#define AES_ROUNDS(size) ((int)(size)/4+6)
+#endif // AES_ROUNDS
+
+/** Longest text that AES-GCM can encrypt under a single IV, beyond which its
+ * 32-bit block counter would wrap into the next IV. */
+#ifndef AES_GCMMAX
+#define AES_GCMMAX ((1ull<<36)-32)
+#endif // AES_GCMMAX
+
+//_____________________________________________________________________________
+
 // ------ TYPES ------ //
 
 /** Necessary data for cryptographic transformation. */
@@ -22,22 +40,177 @@ typedef struct _CrypText {
   size_t len; // length of the text
 } /** Cryptographic data type alias. */ CrypText;
 
+/** Text transformed with its own key. */
+typedef struct _CrypMsg {
+  const unsigned char* key; // 256-bit key
+  CrypText data; // text with its nonce
+} /** Cryptographic message type alias. */ CrypMsg;
+
+/** Sizes in bytes of the keys of the block cipher. */
+typedef enum _AesSize {
+  AES_128 = 16, AES_192 = 24, AES_256 = 32
+} /** Key size type alias. */ AesSize;
+
+/** Implementations of the block cipher. */
+typedef enum _AesImpl {
+  AES_TABLE, AES_BITSLICE, AES_HARDWARE, AES_VECTOR
+} /** Block cipher implementation type alias. */ AesImpl;
+
+/** Block cipher context, which holds an expanded key and the implementation
+ * chosen when it was created, so that both are reused by every call. The key
+ * schedule takes 4*rounds+4 words, up to 60 with a 256-bit key. */
+typedef struct _Aes {
+  uint32_t rk[60]; // encryption key schedule
+  int rounds; // number of rounds, 10, 12 or 14 depending on the key size
+  AesImpl impl; // implementation used with this key
+} /** Pointer to the cipher context. */ *Aes;
+
+/** AES-GCM context, which adds to a block cipher context the hash key in the
+ * forms used by each GHASH implementation. */
+typedef struct _AesGcm {
+  struct _Aes aes; // block cipher context
+  uint64_t hh[16], hl[16]; // multiples of the hash key by every nibble
+  unsigned char hp[4][16]; // byte-reflected powers of the hash key
+  bool clmul; // whether carry-less products are used
+} /** Pointer to the AES-GCM context. */ *AesGcm;
+
 //_____________________________________________________________________________
 
 // ------ FUNCTIONS ------ //
 
-/** Performs a cryptographic transformation to the text with the given key. */
+/** Performs a cryptographic transformation to the text with the given 256-bit
+ * key. */
 void aes_transform(CrypText* data, const unsigned char key[32]);
 
+/** Performs the transformation of aes_transform splitting the text among the
+ * given number of threads, or among all processors if threads is 0. */
+void aes_parallel(CrypText* data, const unsigned char key[32],
+const unsigned threads);
+
+/** Performs the transformation of aes_parallel to a text that continues the
+ * keystream from the given 128-bit block, which allows processing by
+ * chunks. */
+void aes_stream(CrypText* data, const unsigned char key[32],
+const unsigned long long block, const unsigned threads);
+
+/** Performs the transformation of aes_parallel to a text that holds the bytes
+ * of the keystream starting at the given offset, which allows random
+ * access. */
+void aes_range(CrypText* data, const unsigned char key[32],
+const unsigned long long offset, const unsigned threads);
+
+/** Creates a cipher context by expanding once the given key of size bytes. */
+Aes aes_create(const unsigned char* key, const AesSize size);
+
+/** Encrypts n consecutive 128-bit blocks in place with the context aes. */
+void aes_encrypt(Aes aes, unsigned char* pb, const size_t n);
+
+/** Xors the text with the keystream of the context aes that starts at the
+ * given byte offset, splitting the work among the given number of threads, or
+ * among all processors if threads is 0. */
+void aes_counter(Aes aes, CrypText* data, const unsigned long long offset,
+const unsigned threads);
+
+/** Performs the transformation of aes_transform to the n messages, each one
+ * with its own key, interleaving their key expansions and block encryptions,
+ * which pays off with many short messages. */
+void aes_batch(CrypMsg* msgs, const size_t n);
+
+/** Wipes the expanded key of aes and deletes it. */
+void aes_delete(Aes aes);
+
+/** Creates an AES-GCM context by expanding once the given key of size
+ * bytes. */
+AesGcm aes_gcmcreate(const unsigned char* key, const AesSize size);
+
+/** Encrypts the text with AES-GCM and stores its tag, authenticating the
+ * additional data aad too, in a single pass. The 96-bit IV is the nonce of the
+ * text followed by id. Texts longer than AES_GCMMAX bytes are fatal. */
+void aes_gcmseal(AesGcm gcm, CrypText* data, const uint32_t id,
+const unsigned char* aad, const size_t alen, unsigned char tag[16]);
+
+/** Decrypts the text sealed by aes_gcmseal in a single pass and returns
+ * whether its tag matches, in which case alone the text may be used. Texts
+ * longer than AES_GCMMAX bytes never match and are left untouched. */
+bool aes_gcmopen(AesGcm gcm, CrypText* data, const uint32_t id,
+const unsigned char* aad, const size_t alen, const unsigned char tag[16]);
+
+/** Wipes the keys of gcm and deletes it. */
+void aes_gcmdelete(AesGcm gcm);
+
+/** Returns the implementation currently used by the block cipher. */
+AesImpl aes_impl(void);
+
+/** Selects an implementation for the block cipher if it is supported. */
+bool aes_select(const AesImpl impl);
+
 //_____________________________________________________________________________
 
 // ------ AUXILIARIES ------ //
 
-/** Expands the given 256-bit key into the encryption key schedule rk. */
-void aes_setenc(uint32_t rk[60], const unsigned char key[32]);
+/** Initializes the context aes with the given key of size bytes and the
+ * implementation currently used, without allocating it. */
+void aes_init(Aes aes, const unsigned char* key, const AesSize size);
+
+/** Initializes the context gcm with the given key of size bytes, without
+ * allocating it. GHASH uses carry-less products if supported, unless the
+ * implementation of the block cipher is the one with lookup tables. */
+void aes_gcminit(AesGcm gcm, const unsigned char* key, const AesSize size);
+
+/** Absorbs data into the GHASH value x, padding it to whole blocks. */
+void aes_ghash(AesGcm gcm, unsigned char x[16], const unsigned char* data,
+const size_t len);
+
+/** Expands the given key of size bytes into the encryption key schedule rk,
+ * filling the 4*AES_ROUNDS(size)+4 words it takes. */
+void aes_setenc(uint32_t rk[60], const unsigned char* key,
+const AesSize size);
+
+/** Encrypts the given 128-bit block using the expanded key rk of the given
+ * number of rounds. */
+void aes_encblock(const uint32_t rk[60], const int rounds,
+unsigned char pb[16]);
+
+/** Encrypts n consecutive 128-bit blocks using the expanded key rk of the
+ * given number of rounds. */
+void aes_encblocks(const uint32_t rk[60], const int rounds, unsigned char* pb,
+const size_t n);
+
+/** Xors text with the keystream that starts at the given counter. */
+void aes_ctr(Aes aes, unsigned long long nonce,
+unsigned long long count, unsigned char* text, const size_t len);
+
+/** Xors len bytes of text with the given stream, in the widest vector
+ * registers of the processor, whose accesses are aligned once the text reaches
+ * their alignment if the stream shares it. */
+void aes_xor(unsigned char* text, const unsigned char* stream,
+const size_t len);
+
+/** Xors text with the keystream that starts at the given counter, splitting
+ * the work among the given number of threads, or all processors if 0. */
+void aes_split(Aes aes, const unsigned long long nonce,
+const unsigned long long count, unsigned char* text, const size_t len,
+const unsigned threads);
+
+/** Xors text with the keystream that starts at the given byte offset. */
+void aes_seek(Aes aes, const unsigned long long nonce,
+const unsigned long long offset, unsigned char* text, const size_t len,
+const unsigned threads);
+
+/** Encrypts the given 128-bit block with lookup tables using rk of the given
+ * number of rounds. */
+void aes_tableblock(const uint32_t rk[60], const int rounds,
+unsigned char pb[16]);
+
+/** Encrypts two consecutive 128-bit blocks at once with lookup tables. */
+void aes_tablepair(const uint32_t rk[60], const int rounds,
+unsigned char pb[32]);
+
+/** Checks if the processor supports the given implementation. */
+bool aes_supports(const AesImpl impl);
 
-/** Encrypts the given 128-bit block using the expanded key rk. */
-void aes_encblock(const uint32_t rk[60], unsigned char pb[16]);
+/** Returns the number of processors available. */
+unsigned aes_cores(void);
 
 //_____________________________________________________________________________
 
@@ -0,0 +1,263 @@
+/// HEADER - ARCHIVE
+/** Header file for a seekable format of encrypted files split in chunks. */
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+//_____________________________________________________________________________
+
+// ------ INCLUDES ------ //
+
+#include "aesctr.h"
+#include "chacha.h"
+#include "lz.h"
+
+//_____________________________________________________________________________
+
+// ------ MACROS ------ //
+
+/** Bytes that open every archive. */
+#ifndef ARC_MAGIC
+#define ARC_MAGIC "CCPS"
+#endif // ARC_MAGIC
+
+/** Version of the format that is written. */
+#ifndef ARC_VERSION
+#define ARC_VERSION 1
+#endif // ARC_VERSION
+
+/** Default base 2 logarithm of the size of the chunks. */
+#ifndef ARC_SHIFT
+#define ARC_SHIFT 20
+#endif // ARC_SHIFT
+
+/** Bounds of the base 2 logarithm of the size of the chunks. */
+#ifndef ARC_MINSHIFT
+#define ARC_MINSHIFT 12
+#endif // ARC_MINSHIFT
+#ifndef ARC_MAXSHIFT
+#define ARC_MAXSHIFT 30
+#endif // ARC_MAXSHIFT
+
+/** Size in bytes of the header, the chunk length prefix and the trailer. */
+#ifndef ARC_HEAD
+#define ARC_HEAD ((size_t)16)
+#endif // ARC_HEAD
+#ifndef ARC_PREFIX
+#define ARC_PREFIX ((size_t)4)
+#endif // ARC_PREFIX
+#ifndef ARC_TAIL
+#define ARC_TAIL ((size_t)24)
+#endif // ARC_TAIL
+
+/** Flag of the archives whose chunks and trailer carry AES-GCM tags. */
+#ifndef ARC_AUTH
+#define ARC_AUTH 0x01
+#endif // ARC_AUTH
+
+/** Flag of the archives whose chunks are compressed before being encrypted
+ * when that makes them shorter. */
+#ifndef ARC_LZ
+#define ARC_LZ 0x02
+#endif // ARC_LZ
+
+/** Size in bytes of an authentication tag. */
+#ifndef ARC_TAG
+#define ARC_TAG ((size_t)16)
+#endif // ARC_TAG
+
+/** Number of ciphers that the chunks of an archive may use. */
+#ifndef ARC_CIPHERS
+#define ARC_CIPHERS 4
+#endif // ARC_CIPHERS
+
+//_____________________________________________________________________________
+
+// ------ TYPES ------ //
+
+/** Ciphers of the chunks of an archive, AES-CTR with each key size, where
+ * AES-256 keeps the value of the first archives, or ChaCha20, which cannot be
+ * authenticated. */
+typedef enum _ArcCipher {
+  ARC_AES256, ARC_AES128, ARC_AES192, ARC_CHACHA
+} /** Archive cipher type alias. */ ArcCipher;
+
+/** Cipher contexts of an archive, of which only the one of its cipher is
+ * used. */
+typedef struct _ArcKey {
+  AesGcm gcm; // context of AES, or NULL
+  Chacha chacha; // context of ChaCha20, or NULL
+} /** Archive key type alias. */ ArcKey;
+
+/** Settings stored in the header of an archive. The header holds the magic
+ * bytes, the version, the cipher, the flags, the shift and the nonce, then
+ * every chunk follows with its length as a prefix, then an empty prefix, the
+ * offset of each chunk record and a trailer with the offset of that index, the
+ * number of chunks and the length of the plaintext, all of them big-endian.
+ * With ARC_AUTH, a tag follows each chunk and the trailer, and with ARC_LZ,
+ * the length of each chunk as stored follows its length prefix. */
+typedef struct _ArcHead {
+  unsigned char version; // version of the format
+  unsigned char cipher; // cipher of the chunks, one of ArcCipher
+  unsigned char flags; // optional features of the chunks
+  unsigned char shift; // base 2 logarithm of the size of the chunks
+  unsigned long long nonce; // nonce of the keystream
+} /** Archive header type alias. */ ArcHead;
+
+/** Chunk of an archive being encrypted or decrypted in memory. */
+typedef struct _ArcChunk {
+  unsigned char* text; // bytes of the chunk
+  size_t len; // length of the chunk
+  unsigned char* tag; // authentication tag of the chunk, if there is one
+  size_t size; // length of the chunk as stored, less than len if compressed
+} /** Archive chunk type alias. */ ArcChunk;
+
+/** Archive being written or read. Chunk i holds the plaintext bytes from
+ * i << shift on, so every chunk but the last is full and each one can be
+ * decrypted alone. It is encrypted with the keystream of the cipher of the
+ * header at that same offset, or with AES-GCM using the nonce and i as IV and
+ * the header as additional data if it is authenticated. With ARC_LZ, the chunk
+ * is first compressed by lz_compress unless that does not make it shorter, so
+ * only the bytes stored are encrypted, and the length prefix is authenticated
+ * along with the header. The trailer is then authenticated as additional data
+ * along with the header, using the nonce and 2^32-1 as IV. */
+typedef struct _Arc {
+  FILE* fp; // underlying file
+  ArcHead head; // settings of the archive
+  ArcKey key; // cipher contexts of the chunks, owned by the caller
+  unsigned long long* offs; // file offset of the record of each chunk
+  size_t count, cap; // number of chunks and capacity of the offsets
+  unsigned long long len; // length of the plaintext
+  unsigned long long pos; // file offset of the next record
+  bool end; // whether all the chunks are known
+} /** Pointer to the archive. */ *Arc;
+
+//_____________________________________________________________________________
+
+// ------ FUNCTIONS ------ //
+
+/** Starts writing an archive with the given header into fp, encrypting it with
+ * key, or returns NULL if the header cannot be written. */
+Arc arc_create(FILE* fp, const ArcHead* head, const ArcKey key);
+
+/** Encrypts len bytes of text in place, splitting the chunks among the given
+ * number of threads, or all processors if 0, and appends them to arc. Only the
+ * last chunk of an archive may be shorter than the chunk size. */
+bool arc_write(Arc arc, unsigned char* text, const size_t len,
+const unsigned threads);
+
+/** Appends to arc the given chunks, already encrypted by arc_seal as the next
+ * ones of the archive, along with their tags if it is authenticated. */
+bool arc_append(Arc arc, const ArcChunk* chunks, const size_t count);
+
+/** Writes the end of the chunks, the index and the trailer of arc. */
+bool arc_finish(Arc arc);
+
+/** Starts reading the archive in fp right after its header head, decrypting it
+ * with key. If fp is NULL, the archive is only used to transform chunks kept
+ * in memory. */
+Arc arc_open(FILE* fp, const ArcHead* head, const ArcKey key);
+
+/** Reads into buf as many of the next chunks of arc as fit in cap bytes, which
+ * must hold at least one, and decrypts them splitting the chunks among the
+ * given number of threads, or all processors if 0. Stores their length in len,
+ * 0 once there are no chunks left, in which case the index and the trailer are
+ * checked. Returns false on error or if a tag does not match. */
+bool arc_next(Arc arc, unsigned char* buf, const size_t cap, size_t* len,
+const unsigned threads);
+
+/** Reads into buf as many of the next chunks of arc as fit in cap bytes, which
+ * must hold at least one, without decrypting them, each one taking the room of
+ * its plaintext. Describes them in chunks, which must have room for all of
+ * them, reading the tag of each one where its tag already points if
+ * authenticated, and stores their number in count, 0 once there are no chunks
+ * left, in which case the index and the trailer are checked. Returns false on
+ * error. */
+bool arc_take(Arc arc, unsigned char* buf, const size_t cap, ArcChunk* chunks,
+size_t* count);
+
+/** Loads the index of arc from the end of its file, moving the position of the
+ * file. Returns whether the index is consistent. */
+bool arc_index(Arc arc);
+
+/** Decrypts into buf up to len plaintext bytes of arc starting at offset,
+ * reading and decrypting only the chunks involved, which are verified whole if
+ * authenticated. Returns the bytes read. */
+size_t arc_read(Arc arc, const unsigned long long offset, unsigned char* buf,
+const size_t len);
+
+/** Deletes arc, without closing its file or deleting its cipher contexts. */
+void arc_delete(Arc arc);
+
+//_____________________________________________________________________________
+
+// ------ AUXILIARIES ------ //
+
+/** Checks if buf begins with the magic bytes of an archive. */
+bool arc_check(const unsigned char* buf);
+
+/** Writes head into buf. */
+void arc_puthead(unsigned char buf[ARC_HEAD], const ArcHead* head);
+
+/** Reads head from buf, checking that its settings are supported. */
+bool arc_gethead(const unsigned char buf[ARC_HEAD], ArcHead* head);
+
+/** Returns the size in bytes of the key of the given cipher, or 0 if it is
+ * unknown. */
+size_t arc_keysize(const unsigned char cipher);
+
+/** Returns the AES cipher that uses a key of the given size. */
+unsigned char arc_cipher(const AesSize size);
+
+/** Writes the lowest given number of bytes of word into buf, big-endian. */
+void arc_putword(unsigned char* buf, const unsigned long long word,
+const size_t bytes);
+
+/** Reads a big-endian word of the given number of bytes from buf. */
+unsigned long long arc_getword(const unsigned char* buf, const size_t bytes);
+
+/** Returns the number of chunks of a plaintext of len bytes. */
+unsigned long long arc_chunks(const unsigned long long len,
+const unsigned char shift);
+
+/** Returns the size of the record of a chunk stored in len bytes. */
+unsigned long long arc_record(const ArcHead* head,
+const unsigned long long len);
+
+/** Returns the size of the trailer of an archive. */
+size_t arc_tail(const ArcHead* head);
+
+/** Returns the file offset of the record of chunk i in an archive whose chunks
+ * are stored as they are, without ARC_LZ. */
+unsigned long long arc_offset(const ArcHead* head,
+const unsigned long long i);
+
+/** Returns the size of an archive of a plaintext of len bytes whose chunks are
+ * stored as they are, without ARC_LZ. */
+unsigned long long arc_size(const ArcHead* head,
+const unsigned long long len);
+
+/** Writes into buf, of arc_size bytes, everything of the archive arc of a
+ * plaintext of len bytes but the chunks themselves and their tags, which must
+ * not have ARC_LZ. */
+void arc_frame(Arc arc, unsigned char* buf, const unsigned long long len);
+
+/** Encrypts the given chunks of arc in place, the first one being chunk first,
+ * and stores their tags if authenticated, splitting the chunks among the given
+ * number of threads, or all processors if 0. Each one is compressed first with
+ * ARC_LZ, and its length as stored is set in any case. */
+void arc_seal(Arc arc, ArcChunk* chunks, const size_t count,
+const unsigned long long first, const unsigned threads);
+
+/** Decrypts the chunks encrypted by arc_seal, along with their length as
+ * stored with ARC_LZ, and returns whether all their tags match. If not, the
+ * chunks are left encrypted. Otherwise, those that were compressed are then
+ * decompressed in place, failing if any of them is not valid. */
+bool arc_unseal(Arc arc, ArcChunk* chunks, const size_t count,
+const unsigned long long first, const unsigned threads);
+
+/** Moves the position of fp to the given offset. */
+bool arc_goto(FILE* fp, const unsigned long long offset);
+
+//_____________________________________________________________________________
+
+#endif // __ARCHIVE_H__
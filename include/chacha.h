@@ -0,0 +1,93 @@
+/// HEADER - CHACHA
+/** Header file for a ChaCha20 stream cipher implementation. */
+#ifndef __CHACHA_H__
+#define __CHACHA_H__
+
+//_____________________________________________________________________________
+
+// ------ INCLUDES ------ //
+
+#include "aesctr.h"
+
+//_____________________________________________________________________________
+
+// ------ TYPES ------ //
+
+/** Implementations of the stream cipher. */
+typedef enum _ChachaImpl {
+  CHACHA_SCALAR, CHACHA_SSE2, CHACHA_AVX2
+} /** Stream cipher implementation type alias. */ ChachaImpl;
+
+/** Stream cipher context, which holds the key and the implementation chosen
+ * when it was created, so that both are reused by every call. */
+typedef struct _Chacha {
+  uint32_t key[8]; // words of the 256-bit key
+  ChachaImpl impl; // implementation used with this key
+} /** Pointer to the stream cipher context. */ *Chacha;
+
+//_____________________________________________________________________________
+
+// ------ FUNCTIONS ------ //
+
+/** Performs a cryptographic transformation to the text with the given 256-bit
+ * key. The 64-bit nonce of the text and a 64-bit counter of 64-byte blocks
+ * fill the last four words of the state, as in the original cipher. */
+void chacha_transform(CrypText* data, const unsigned char key[32]);
+
+/** Performs the transformation of chacha_transform splitting the text among
+ * the given number of threads, or among all processors if threads is 0. */
+void chacha_parallel(CrypText* data, const unsigned char key[32],
+const unsigned threads);
+
+/** Creates a stream cipher context with the given 256-bit key. */
+Chacha chacha_create(const unsigned char key[32]);
+
+/** Xors the text with the keystream of the context cc that starts at the given
+ * byte offset, splitting the work among the given number of threads, or among
+ * all processors if threads is 0. */
+void chacha_counter(Chacha cc, CrypText* data,
+const unsigned long long offset, const unsigned threads);
+
+/** Wipes the key of cc and deletes it. */
+void chacha_delete(Chacha cc);
+
+/** Returns the implementation currently used by the stream cipher. */
+ChachaImpl chacha_impl(void);
+
+/** Selects an implementation for the stream cipher if it is supported. */
+bool chacha_select(const ChachaImpl impl);
+
+//_____________________________________________________________________________
+
+// ------ AUXILIARIES ------ //
+
+/** Initializes the context cc with the given key and the implementation
+ * currently used, without allocating it. */
+void chacha_init(Chacha cc, const unsigned char key[32]);
+
+/** Stores in ks n consecutive 64-byte blocks of the keystream of cc, from the
+ * given block on. */
+void chacha_blocks(Chacha cc, const unsigned long long nonce,
+const unsigned long long block, unsigned char* ks, const size_t n);
+
+/** Xors text with the keystream that starts at the given block. */
+void chacha_stream(Chacha cc, const unsigned long long nonce,
+const unsigned long long block, unsigned char* text, const size_t len);
+
+/** Xors text with the keystream that starts at the given block, splitting the
+ * work among the given number of threads, or all processors if 0. */
+void chacha_split(Chacha cc, const unsigned long long nonce,
+const unsigned long long block, unsigned char* text, const size_t len,
+const unsigned threads);
+
+/** Xors text with the keystream that starts at the given byte offset. */
+void chacha_seek(Chacha cc, const unsigned long long nonce,
+const unsigned long long offset, unsigned char* text, const size_t len,
+const unsigned threads);
+
+/** Checks if the processor supports the given implementation. */
+bool chacha_supports(const ChachaImpl impl);
+
+//_____________________________________________________________________________
+
+#endif // __CHACHA_H__
@@ -0,0 +1,35 @@
+/// HEADER - COMPRESSION
+/** Header file for a fast LZ77 compressor of independent blocks. */
+#ifndef __LZ_H__
+#define __LZ_H__
+
+//_____________________________________________________________________________
+
+// ------ INCLUDES ------ //
+
+#include "basics.h"
+#include <stddef.h>
+
+//_____________________________________________________________________________
+
+// ------ FUNCTIONS ------ //
+
+/** Compresses the len bytes of src into dst, which has room for cap bytes. The
+ * block is a series of sequences, each one made of a token, whose high and low
+ * nibbles hold the number of literals and the length of the match minus 4, the
+ * extra bytes of the first if it is 15 or more, the literals, the distance of
+ * the match in 2 little-endian bytes and the extra bytes of its length, like
+ * LZ4 blocks. The last sequence only holds literals. Returns the length of the
+ * block, or 0 if it does not fit in cap bytes. */
+size_t lz_compress(const unsigned char* src, const size_t len,
+unsigned char* dst, const size_t cap);
+
+/** Decompresses the block of len bytes in src into dst, which has room for
+ * size bytes. Returns whether the block is valid and fills exactly size
+ * bytes. */
+bool lz_decompress(const unsigned char* src, const size_t len,
+unsigned char* dst, const size_t size);
+
+//_____________________________________________________________________________
+
+#endif // __LZ_H__
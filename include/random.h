@@ -1,5 +1,6 @@
 /// HEADER - RANDOM
-/** Header file for a 32-bit Mersenne Twister pseudorandom generator. */
+/** Header file for Mersenne Twister, xoshiro256** and PCG64 pseudorandom
+ * generators and an AES-CTR cryptographically secure one. */
 #ifndef __RANDOM_H__
 #define __RANDOM_H__
 
@@ -7,17 +8,36 @@
 
 // ------ INCLUDES ------ //
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <time.h>
 
 //_____________________________________________________________________________
 
 // ------ MACROS ------ //
 
-/** Generates random 32-bit integer on range [a,b). */
+/** Number of 32-bit words of the state of a Mersenne Twister generator. */
+#ifndef RANDOM_N
+#define RANDOM_N ((size_t)624)
+#endif // RANDOM_N
+
+/** Algorithm of the default generator and of the ones created without choosing
+ * one, one of RandomKind. */
+#ifndef RANDOM_KIND
+#define RANDOM_KIND RANDOM_MT
+#endif // RANDOM_KIND
+
+/** Base 2 logarithm of the distance between the streams of the generators
+ * derived by random_split. */
+#ifndef RANDOM_JUMP
+#define RANDOM_JUMP 128
+#endif // RANDOM_JUMP
+
+/** Generates random 32-bit integer on range [a,b), without bias. */
 #ifndef IRNDI
 #define IRNDI(a,b) \
-  (random_int()%((b)-(a))+(a))
+  (random_below(NULL,(uint32_t)((b)-(a)))+(a))
 #endif // IRNDI
 
 /** Generates random real on range [a,b). */
@@ -28,17 +48,155 @@
 
 //_____________________________________________________________________________
 
+// ------ TYPES ------ //
+
+/** Algorithms of the pseudorandom generators: the 32-bit Mersenne Twister
+ * MT19937, with a state of 2.5 KB, or the 64-bit xoshiro256** and PCG64 with
+ * the XSL-RR output, whose states take 32 bytes and whose steps are a few
+ * instructions. */
+typedef enum _RandomKind {
+  RANDOM_MT, RANDOM_XOSHIRO, RANDOM_PCG
+} /** Generator algorithm type alias. */ RandomKind;
+
+/** Pseudorandom generator, which owns its state so that each thread can use
+ * its own one. Every function that takes a generator uses the default one of
+ * random_int instead if it is NULL, which is not safe to share among
+ * threads. */
+typedef struct _Random {
+  RandomKind kind; // algorithm of the generator
+  union {
+    struct {
+      uint32_t mt[RANDOM_N]; // state vector
+      size_t mti; // index of the next word of the state vector
+    }; // state of the Mersenne Twister
+    uint64_t xs[4]; // state of xoshiro256**
+    struct {
+      uint64_t state[2]; // state, highest half first
+      uint64_t inc[2]; // odd increment, highest half first
+    }; // state of PCG64
+  };
+} /** Pointer to the generator. */ *Random;
+
+//_____________________________________________________________________________
+
 // ------ FUNCTIONS ------ //
 
-/** Initializes the state vector with a seed. */
+/** Initializes the state of the default generator with a seed. */
 void random_seed(const uint32_t seed);
 
-/** Generates a random 32-bit natural number, that is, on range [0,2^32). */
+/** Generates a random 32-bit natural number, that is, on range [0,2^32), with
+ * the default generator, which is seeded from the time if it was not. */
 uint32_t random_int(void);
 
-/** Generates a random real on range [0,1). */
+/** Generates a random real on range [0,1) with the default generator. */
 double random_real(void);
 
+/** Creates a generator of the algorithm RANDOM_KIND with the given seed. */
+Random random_create(const uint32_t seed);
+
+/** Creates a generator of the given algorithm with the given seed. */
+Random random_createkind(const RandomKind kind, const uint32_t seed);
+
+/** Generates a random 32-bit natural number with rng, the highest half of a
+ * number of the 64-bit generators. */
+uint32_t random_next(Random rng);
+
+/** Generates a random 64-bit natural number with rng, made of two numbers of
+ * the Mersenne Twister, the first one being the highest half. */
+uint64_t random_next64(Random rng);
+
+/** Generates a random real on range [0,1) with rng, from the 53 highest bits
+ * of two numbers of the Mersenne Twister or of one of the others, joined as an
+ * integer and converted at once. */
+double random_uniform(Random rng);
+
+/** Generates a random real of the standard normal distribution with rng, by
+ * the ziggurat method of Marsaglia and Tsang with 128 layers. A single 64-bit
+ * number chooses the layer, the sign and the position, and nearly every draw
+ * falls inside its rectangle, which takes a multiplication and a comparison,
+ * while the rest take an exponential, or logarithms for the tail. */
+double random_normal(Random rng);
+
+/** Generates a random real of the exponential distribution of rate 1 with rng,
+ * by the ziggurat method with 256 layers like random_normal. */
+double random_exponential(Random rng);
+
+/** Fills buf with n random 32-bit natural numbers of rng, the same ones as n
+ * calls to random_next. The state of the Mersenne Twister is regenerated and
+ * tempered a whole vector at a time, with the widest registers that the
+ * processor supports. */
+void random_fill(Random rng, uint32_t* buf, const size_t n);
+
+/** Fills buf with n random 64-bit natural numbers of rng, the same ones as n
+ * calls to random_next64. */
+void random_fill64(Random rng, uint64_t* buf, const size_t n);
+
+/** Fills buf with n random reals on range [0,1) of rng, the same ones as n
+ * calls to random_uniform. */
+void random_filldouble(Random rng, double* buf, const size_t n);
+
+/** Fills buf with n random reals of the standard normal distribution of rng,
+ * drawing the 64-bit numbers of a chunk at once with random_fill64 and drawing
+ * more only for those that fall out of their rectangles, so that they are not
+ * the same as n calls to random_normal. */
+void random_fillnormal(Random rng, double* buf, const size_t n);
+
+/** Fills buf with n random reals of the exponential distribution of rate 1 of
+ * rng like random_fillnormal. */
+void random_fillexponential(Random rng, double* buf, const size_t n);
+
+/** Generates a random natural number on range [0,bound) with rng, without bias
+ * nor divisions but in the rare cases where a number is rejected, by keeping
+ * the highest half of its product by bound, as Lemire does. A bound of 0
+ * stands for 2^32. */
+uint32_t random_below(Random rng, const uint32_t bound);
+
+/** Generates a random natural number on range [0,bound) with rng like
+ * random_below, from 64-bit numbers. A bound of 0 stands for 2^64. */
+uint64_t random_below64(Random rng, const uint64_t bound);
+
+/** Fills buf with n random natural numbers on range [0,bound) of rng, drawing
+ * all of them at once with random_fill and dividing once to find the ones to
+ * reject, which are then drawn again. A bound of 0 stands for 2^32. */
+void random_fillbelow(Random rng, uint32_t* buf, const size_t n,
+const uint32_t bound);
+
+/** Fills buf with n random natural numbers on range [0,bound) of rng like
+ * random_fillbelow, from 64-bit numbers. A bound of 0 stands for 2^64. */
+void random_fillbelow64(Random rng, uint64_t* buf, const size_t n,
+const uint64_t bound);
+
+/** Moves rng 2^e steps ahead, as if that many 32-bit numbers of the Mersenne
+ * Twister or 64-bit ones of the others were generated. */
+void random_jump(Random rng, const unsigned e);
+
+/** Creates a generator whose stream does not overlap the one that rng produces
+ * afterwards, depending only on the seed of rng and its calls. */
+Random random_split(Random rng);
+
+/** Deletes rng. */
+void random_delete(Random rng);
+
+/** Fills buf with len cryptographically secure random bytes, the keystream of
+ * AES-256 in counter mode. The key is drawn from the system at first, after a
+ * fork and every RANDOM_RESEED bytes, and replaced after each call with fresh
+ * keystream, so that earlier bytes cannot be recovered from it. It is safe to
+ * call from several threads. Returns false if the system cannot provide a key,
+ * in which case buf is filled with zeros. */
+bool random_secure(void* buf, const size_t len);
+
+//_____________________________________________________________________________
+
+// ------ AUXILIARIES ------ //
+
+/** Initializes rng as a generator of the algorithm RANDOM_KIND with a seed,
+ * without allocating it. */
+void random_init(Random rng, const uint32_t seed);
+
+/** Initializes rng as a generator of the given algorithm with a seed, without
+ * allocating it. The 64-bit generators expand the seed with SplitMix64. */
+void random_initkind(Random rng, const RandomKind kind, const uint32_t seed);
+
 //_____________________________________________________________________________
 
 #endif // __RANDOM_H__
@@ -0,0 +1,186 @@
+/// MAIN - BENCHMARK
+/** Main file for a benchmark of the pseudorandom generators. */
+#ifndef __MAIN__
+#define __MAIN__
+
+//_____________________________________________________________________________
+
+// ------ INCLUDES ------ //
+
+#include "../../include/random.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//_____________________________________________________________________________
+
+// ------ MACROS ------ //
+
+/** Default millions of numbers drawn by each measurement. */
+#ifndef BEN_COUNT
+#define BEN_COUNT 64ul
+#endif // BEN_COUNT
+
+/** Repetitions of each measurement, of which the fastest one is kept. */
+#ifndef BEN_REPS
+#define BEN_REPS 3
+#endif // BEN_REPS
+
+/** Numbers of the buffer that the bulk functions fill at once. */
+#ifndef BEN_BUFFER
+#define BEN_BUFFER ((size_t)4096)
+#endif // BEN_BUFFER
+
+/** Seed of every generator, so that each run draws the same numbers. */
+#ifndef BEN_SEED
+#define BEN_SEED 5489u
+#endif // BEN_SEED
+
+//_____________________________________________________________________________
+
+// ------ TYPES ------ //
+
+/** Functions of the generators whose speed is measured. */
+typedef enum _BenOp {
+  NEXT, NEXT64, UNIFORM, FILL, FILL64, FILLDOUBLE, OPS
+} /** Measured function type alias. */ BenOp;
+
+//_____________________________________________________________________________
+
+// ------ VARIABLES ------ //
+
+/** Names of the measured functions. */
+static const char* const benops[OPS] = {
+  "random_next", "random_next64", "random_uniform", "random_fill",
+  "random_fill64", "random_filldouble"
+};
+
+/** Buffers of the bulk functions. */
+static uint32_t benwords[BEN_BUFFER];
+static uint64_t benwides[BEN_BUFFER];
+static double benreals[BEN_BUFFER];
+
+/** Sink of the numbers drawn, so that they are not optimized away. */
+static volatile uint64_t bensink;
+
+//_____________________________________________________________________________
+
+// ------ STATICS ------ //
+
+/** Prints helpful information for the program. */
+static void ben_help(void) {
+  // Print help
+  puts("Measures the speed of the pseudorandom generators.");
+  puts("Usage: benchmark [option]");
+  puts("The possible options are:");
+  puts(" * -h  provides helpful information and exits.");
+  puts(" * a number of millions of numbers drawn by each measurement,");
+  printf("   %lu by default.\n",BEN_COUNT);
+  puts("Each function is measured with the Mersenne Twister, xoshiro256**");
+  puts("and PCG64 generators, all of them seeded alike, keeping the fastest");
+  printf("of %d repetitions. The speeds are given in millions of numbers\n",
+  BEN_REPS);
+  printf("per second, the bulk functions filling %zu numbers at a time.\n",
+  BEN_BUFFER);
+}
+
+/** Returns the current time in seconds. */
+static double ben_now(void) {
+  // Read the calendar time at its finest resolution
+  struct timespec t;
+  timespec_get(&t,TIME_UTC);
+  return (double)t.tv_sec+(double)t.tv_nsec*1e-9;
+}
+
+/** Draws n numbers from rng with the function op and returns the seconds
+ * that it took. */
+static double ben_run(Random rng, const BenOp op, const size_t n) {
+  // Draw the numbers, folding them into a sum
+  uint64_t sum = 0;
+  double real = 0, start = ben_now();
+  for (size_t i = 0, k; i < n; i += k) {
+    k = (op < FILL) ? n-i : (n-i < BEN_BUFFER) ? n-i : BEN_BUFFER;
+    switch (op) {
+      case NEXT:
+        for (size_t j = 0; j < k; ++j)
+          sum += random_next(rng);
+        break;
+      case NEXT64:
+        for (size_t j = 0; j < k; ++j)
+          sum += random_next64(rng);
+        break;
+      case UNIFORM:
+        for (size_t j = 0; j < k; ++j)
+          real += random_uniform(rng);
+        break;
+      case FILL:
+        random_fill(rng,benwords,k), sum += benwords[k-1];
+        break;
+      case FILL64:
+        random_fill64(rng,benwides,k), sum += benwides[k-1];
+        break;
+      default:
+        random_filldouble(rng,benreals,k), real += benreals[k-1];
+    }
+  }
+  // Keep the sum and return the time
+  double elapsed = ben_now()-start;
+  bensink = sum+(uint64_t)real;
+  return elapsed;
+}
+
+/** Prints the speed of every function with every generator, drawing n
+ * numbers in each measurement. */
+static void ben_table(const size_t n) {
+  // Print the generators
+  const RandomKind kinds[] = {RANDOM_MT, RANDOM_XOSHIRO, RANDOM_PCG};
+  printf("%-20s%14s%14s%14s\n","M/s","mt19937","xoshiro256**","pcg64");
+  // Measure each function with each generator
+  for (int op = NEXT; op < OPS; ++op) {
+    printf("%-20s",benops[op]);
+    for (size_t g = 0; g < sizeof(kinds)/sizeof(*kinds); ++g) {
+      Random rng = random_createkind(kinds[g],BEN_SEED);
+      double best = -1;
+      for (int r = 0; r < BEN_REPS; ++r) {
+        double t = ben_run(rng,(BenOp)op,n);
+        best = (best < 0 || t < best) ? t : best;
+      }
+      random_delete(rng);
+      printf("%14.1f",(best > 0) ? (double)n/best*1e-6 : 0.0);
+    }
+    putchar('\n');
+  }
+}
+
+//_____________________________________________________________________________
+
+// ------ MAIN ------ //
+
+int main(int argc, char** argv) {
+  // Check the arguments
+  if (argc > 2) {
+    fputs("ERROR: Too many arguments given.\n",stderr);
+    return EXIT_FAILURE;
+  }
+  if (argc == 2 && !strcmp(argv[1],"-h")) {
+    ben_help();
+    return EXIT_SUCCESS;
+  }
+  // Get the millions of numbers of each measurement
+  unsigned long count = BEN_COUNT;
+  if (argc == 2) {
+    char* end;
+    count = strtoul(argv[1],&end,10);
+    if (*end || !count || count > 1000000) {
+      fputs("ERROR: Invalid argument given.\n",stderr);
+      return EXIT_FAILURE;
+    }
+  }
+  // Measure the generators
+  ben_table((size_t)count*1000000);
+  return EXIT_SUCCESS;
+}
+
+//_____________________________________________________________________________
+
+#endif // __MAIN__
@@ -7,8 +7,65 @@
 
 // ------ INCLUDES ------ //
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif // _POSIX_C_SOURCE
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif // __linux__
+
 #include "../../include/strings.h"
-#include "../../include/aesctr.h"
+#include "../../include/archive.h"
+#include "../../include/random.h"
+#include <pthread.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/types.h>
+#endif // _WIN32
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // __unix__ || __APPLE__
+
+//_____________________________________________________________________________
+
+// ------ MACROS ------ //
+
+/** Number of bytes read, transformed and written at a time. */
+#ifndef SEC_CHUNK
+#define SEC_CHUNK ((size_t)1<<22)
+#endif // SEC_CHUNK
+
+/** Number of buffers in the ring of a pipeline, one for each stage. */
+#ifndef SEC_SLOTS
+#define SEC_SLOTS 3
+#endif // SEC_SLOTS
+
+/** Capacity requested for the pipes of a filter, which the system may cap. */
+#ifndef SEC_PIPE
+#define SEC_PIPE ((size_t)1<<20)
+#endif // SEC_PIPE
+
+/** Extension of the temporary file used when overwriting the input. */
+#ifndef SEC_TEMP
+#define SEC_TEMP ".tmp"
+#endif // SEC_TEMP
+
+/** Indicates if files can be transformed through memory mappings. */
+#ifndef SEC_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define SEC_MMAP 1
+#else
+#define SEC_MMAP 0
+#endif // __unix__ || __APPLE__
+#endif // SEC_MMAP
 
 //_____________________________________________________________________________
 
@@ -19,6 +76,72 @@ typedef enum _CrypOp {
   MANY = -2, INVALID, NONE, HELP, ENCRYPT, DECRYPT
 } /** Cryptographic transformation type alias. */ CrypOp;
 
+/** Optional settings of a cryptographic transformation. */
+typedef struct _CrypOpts {
+  bool mapped; // transform the files through memory mappings
+  bool authenticated; // authenticate the archive with AES-GCM tags
+  AesSize size; // size of the key of the archives written
+  bool chacha; // write the archives with ChaCha20 instead of AES
+  bool compressed; // compress the chunks of the archives written
+  const char* keyfile; // file with the key, NULL if interactive
+  bool filter; // transform stdin into stdout instead of a batch of files
+} /** Transformation settings type alias. */ CrypOpts;
+
+/** File of a batch along with the result of its transformation. */
+typedef struct _CrypJob {
+  Str in, out; // input file and output file, empty to overwrite the input
+  unsigned long long bytes; // size of the input file
+  const char* error; // reason of the failure, NULL if it succeeded
+} /** Batch file type alias. */ CrypJob;
+
+/** Batch of files transformed concurrently by a pool of workers. */
+typedef struct _CrypBatch {
+  CrypJob* jobs; // files of the batch
+  size_t count, next; // number of files and next one to be taken
+  ArcKey keys[ARC_CIPHERS]; // cipher contexts shared by every file
+  CrypOp op; // transformation of the files
+  const CrypOpts* opts; // settings of the transformation
+  unsigned threads; // threads used by each worker
+  pthread_mutex_t lock; // guard of the next file and of the output
+} /** Batch type alias. */ CrypBatch;
+
+/** Buffer of the ring that connects the stages of a pipeline. */
+typedef struct _CrypSlot {
+  unsigned char* text; // bytes held by the slot
+  size_t len; // number of bytes held, 0 once the input is over
+  ArcChunk* chunks; // chunks of an archive held by the slot, if any
+  unsigned char* tags; // room for the tags of the chunks
+  size_t count; // number of chunks
+  unsigned long long first; // offset of the bytes or index of the chunks
+} /** Pipeline slot type alias. */ CrypSlot;
+
+/** State shared by the stages of the pipeline of a file. */
+typedef struct _CrypFlow {
+  FILE *in, *out; // input and output files
+  Arc arc; // archive being written or read, NULL for a legacy file
+  Aes aes; // cipher context of a legacy file
+  unsigned long long nonce; // nonce of a legacy file
+  unsigned long long next; // offset of the next bytes read
+  size_t cap; // capacity in bytes of each slot
+  unsigned threads; // threads used by the transformation
+} /** Pipeline state type alias. */ CrypFlow;
+
+/** Stage of a pipeline, which fills, transforms or empties a slot. */
+typedef bool (*CrypStage) (CrypFlow* flow, CrypSlot* slot);
+
+/** Pipeline that reads, transforms and writes the slots of a ring in three
+ * concurrent stages. */
+typedef struct _CrypPipe {
+  CrypSlot slots[SEC_SLOTS]; // ring of reusable buffers
+  CrypStage stages[3]; // reading, transformation and writing of a slot
+  CrypFlow* flow; // state shared by the stages
+  size_t done[3]; // number of slots through each stage
+  bool over[3]; // whether each stage has finished
+  bool failed; // whether any stage has failed
+  pthread_mutex_t lock; // guard of the counters
+  pthread_cond_t moved; // signal of every change of the counters
+} /** Pipeline type alias. */ CrypPipe;
+
 //_____________________________________________________________________________
 
 // ------ STATICS ------ //
@@ -27,25 +150,70 @@ typedef enum _CrypOp {
 static void sec_help(void) {
   // Print help
   puts("Encrypts and decrypts files.");
-  puts("Usage: secure [option]");
+  puts("Usage: secure [option] [flags]");
   puts("The possible options are:");
   puts(" * -h  provides helpful information and exits.");
   puts(" * -e  encrypts a file.");
   puts(" * -d  attemps to decrypt a file.");
+  puts("The possible flags, along with -e or -d, are:");
+  puts(" * -m  maps the files in memory instead of reading them by chunks.");
+  puts(" * -a  authenticates the archive, or requires it to be so.");
+  puts(" * -b  followed by a key file, transforms a batch of files at once.");
+  puts(" * -f  followed by a key file, transforms stdin into stdout.");
+  puts(" * -k  followed by 128, 192 or 256, sets the bits of the key when");
+  puts("       encrypting, 256 by default, with 128 being the fastest.");
+  puts(" * -c  when encrypting, uses ChaCha20 with a 256-bit key instead of");
+  puts("       AES, which is faster without AES instructions but cannot be");
+  puts("       authenticated.");
+  puts(" * -z  when encrypting, compresses each chunk before encrypting it");
+  puts("       if that makes it shorter, which cannot be mapped.");
   puts("If encryption is chosen, the following are required:");
-  puts(" * a 256-bit encryption key.");
-  puts(" * a 64-bit nonce, optional, 0 by default.");
+  puts(" * an encryption key of up to 16, 24 or 32 bytes, as -k says.");
+  puts(" * a 64-bit nonce, optional, random by default.");
   puts(" * an input file with the plaintext.");
-  puts(" * an output file where to print the ciphertext.");
+  puts(" * an output file where to print the archive with the ciphertext.");
   puts("If decryption is chosen, the following are required:");
-  puts(" * the 256-bit key used in the encryption.");
-  puts(" * an input file with the nonce and ciphertext.");
+  puts(" * the key used in the encryption.");
+  puts(" * an input file with the archive, or with the nonce and ciphertext.");
   puts(" * an output file where to print the plaintext.");
   puts("In both cases, the default output file is the given input file.");
+  puts("In a batch, the key is the first line of the key file and each line");
+  puts("of stdin holds an input file, followed by a tab and its output file");
+  puts("unless the input is overwritten. Each encrypted file gets a random");
+  puts("nonce, and the files are transformed concurrently.");
+  puts("As a filter, the key is read likewise and the data streams through,");
+  puts("with a random nonce if encrypting, and it cannot be mapped.");
+}
+
+/** Reads the size of a key from its number of bits, which must be 128, 192
+ * or 256. Returns whether it is one of them. */
+static bool sec_keysize(const char* bits, AesSize* size) {
+  // Parse the number and check it
+  char* end;
+  unsigned long num = strtoul(bits,&end,10);
+  bool valid = *bits && !*end && (num == 128 || num == 192 || num == 256);
+  if (valid)
+    *size = (AesSize)(num/8);
+  // Return whether it is valid
+  return valid;
+}
+
+/** Turns key, of at most 32 bytes, into a 256-bit key padded with zeros. */
+static unsigned char* sec_fixkey(Str key) {
+  // Fix the size of the key
+  unsigned char* fixed = (unsigned char*)key->word;
+  if (key->len != 32)
+    fixed = REALLOC(fixed,sizeof(char)*32);
+  for (size_t i = key->len+1; i < 32; ++i)
+    fixed[i] = '\0';
+  // Free extra memory
+  free(key);
+  // Return the fixed key
+  return fixed;
 }
 
-/** Gets key from stdin. */
-static unsigned char* sec_getkey(void) {
+/** Gets key, of at most limit bytes, from stdin. */
+static unsigned char* sec_getkey(const size_t limit) {
   // Wait for a key
   fputs("Key: ",stdout);
   // Read key from stdin
@@ -53,42 +221,50 @@ static unsigned char* sec_getkey(void) {
   for (bool valid = false; !valid; ) {
     key = str_get(stdin,false);
     // Check if key es valid
-    if (!(valid = key->len <= 32)) {
-      fputs("Key cannot exceed 32 bytes long, try again.\nKey: ",stdout);
+    if (!(valid = key->len <= limit)) {
+      printf("Key cannot exceed %zu bytes long, try again.\nKey: ",limit);
       str_delete(key);
     }
   }
-  // Fix the size of the key
-  unsigned char* fixed = (unsigned char*)key->word;
-  if (key->len != 32)
-    fixed = REALLOC(fixed,sizeof(char)*32);
-  for (size_t i = key->len+1; i < 32; ++i)
-    fixed[i] = '\0';
-  // Free extra memory
-  free(key);
   // Return the fixed key
-  return fixed;
+  return sec_fixkey(key);
+}
+
+/** Draws a nonce from the secure random generator. */
+static bool sec_drawnonce(unsigned long long* nonce) {
+  // Draw 8 random bytes
+  unsigned char buf[8];
+  bool success = random_secure(buf,8);
+  // Build the nonce with them
+  *nonce = 0;
+  for (int i = 0; success && i < 8; ++i)
+    *nonce = *nonce<<8|buf[i];
+  // Return whether they were drawn
+  return success;
 }
 
-/** Gets nonce from stdin. */
-static unsigned long long sec_getnonce(void) {
+/** Gets nonce from stdin, drawing a random one if it is left blank so that
+ * archives under the same key never share it. Returns whether it could be
+ * drawn. */
+static bool sec_getnonce(unsigned long long* nonce) {
   // Wait for a nonce
   fputs("Nonce: ",stdout);
   // Read nonce from stdin
-  unsigned long long nonce = 0;
+  bool blank = false;
   for (bool valid = false; !valid; ) {
     Str num = str_trim(str_get(stdin,false));
-    // Check if nonce is set to default
-    if (num->len)
-      nonce = (unsigned long long)str_int(num,10,true,false);
+    // Check if nonce is left to be drawn
+    blank = !num->len;
+    if (!blank)
+      *nonce = (unsigned long long)str_int(num,10,true,false);
     // Check if nonce is valid
     if (!(valid = num->len == 0))
       fputs("Nonce must be a number, try again.\nNonce: ",stdout);
     // Free extra memory
     str_delete(num);
   }
-  // Return the nonce
-  return nonce;
+  // Draw the nonce if necessary
+  return !blank || sec_drawnonce(nonce);
 }
 
 /** Gets input file from stdin. */
@@ -111,133 +287,860 @@ static FILE* sec_getinput(Str* name) {
   return file;
 }
 
-/** Gets the necessary data from a file and closes it when finished. */
-static CrypText* sec_getdata(FILE* file, const unsigned long long nonce) {
-  // Initialize the data
-  CrypText* data = malloc(sizeof(CrypText));
-  data->nonce = nonce, data->len = 0;
-  // Read the file
-  size_t cap = 64;
-  data->text = MALLOC(sizeof(char)*cap);
-  for (int c = fgetc(file); c != EOF; c = fgetc(file)) {
-    // Adjust the memory if necessary
-    if (data->len == cap)
-      data->text = REALLOC(data->text,sizeof(char)*(cap<<=1));
-    // Append the last character
-    data->text[data->len++] = (unsigned char)c;
-  }
-  // Fix the memory
-  fclose(file);
-  if (data->len)
-    data->text = REALLOC(data->text,sizeof(char)*data->len);
-  // Return the data
-  return data;
+/** Opens the output file new, which is deleted, for the input file name. It is
+ * the input file if it is empty, and it is written through a temporary file
+ * whose name, ending in SEC_TEMP, is stored in temp unless the input file
+ * itself is mapped, in which case temp is NULL. If the files are to be mapped,
+ * the output is opened for reading and writing, and the input file itself is
+ * opened if chosen. Returns NULL if it cannot be opened. */
+static FILE* sec_openoutput(Str name, Str new, Str* temp, const bool mapped) {
+  // Write to a temporary file unless the input is mapped in place, so that
+  // the output only takes its name once it is complete
+  bool same = !new->len || str_equal(new,name);
+  if (same)
+    str_delete(new), new = str_copy(name);
+  if (!same || !mapped) {
+    Str ext = str_create(SEC_TEMP);
+    new = str_cat(new,ext);
+    str_delete(ext);
+  }
+  FILE* file;
+  if (mapped)
+    file = fopen(new->word,(same) ? "r+b" : "w+b");
+  else
+    file = fopen(new->word,"wb");
+  // Keep the name of the temporary file only
+  if (file && (!same || !mapped))
+    *temp = new;
+  else
+    *temp = NULL, str_delete(new);
+  // Return the open file
+  return file;
 }
 
-/** Gets output file from stdin. */
-static FILE* sec_getoutput(Str name) {
+/** Gets output file from stdin and opens it with sec_openoutput. */
+static FILE* sec_getoutput(Str name, Str* temp, const bool mapped) {
   // Wait for a file name
   fputs("Output file: ",stdout);
-  // Read file name from stdin
+  // Read file name from stdin until it can be opened
   FILE* file = NULL;
-  while (!file) {
-    Str new = str_get(stdin,false);
-    file = (new->len) ? fopen(new->word,"wb") : fopen(name->word,"wb");
-    str_delete(new);
-    if (!file)
-      fputs("Cannot open file, try again.\nOutput file: ",stdout);
-    else
-      str_delete(name);
-  }
+  while (!(file = sec_openoutput(name,str_get(stdin,false),temp,mapped)))
+    fputs("Cannot open file, try again.\nOutput file: ",stdout);
   // Return the open file
   return file;
 }
 
+/** Runs stage s of pipe over every slot in turn, waiting for the previous
+ * stage to fill it, or for the last one to empty it if s is the first. */
+static void sec_stage(CrypPipe* pipe, const int s) {
+  for (size_t k = 0; ; ++k) {
+    // Wait until the slot is ready or nothing else will be
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->failed && ((s) ? k == pipe->done[s-1] && !pipe->over[s-1]
+    : k == pipe->done[2]+SEC_SLOTS))
+      pthread_cond_wait(&pipe->moved,&pipe->lock);
+    bool stop = pipe->failed || (s && k == pipe->done[s-1]);
+    pthread_mutex_unlock(&pipe->lock);
+    // Handle the slot, an empty one meaning the end of the input
+    CrypSlot* slot = pipe->slots+k%SEC_SLOTS;
+    bool success = stop || pipe->stages[s](pipe->flow,slot);
+    stop = stop || !success || (!s && !slot->len);
+    // Let the other stages know
+    pthread_mutex_lock(&pipe->lock);
+    if (stop)
+      pipe->over[s] = true, pipe->failed = pipe->failed || !success;
+    else
+      ++pipe->done[s];
+    pthread_cond_broadcast(&pipe->moved);
+    pthread_mutex_unlock(&pipe->lock);
+    if (stop)
+      return;
+  }
+}
+
+/** Runs the reading stage of a pipeline, used as a thread routine. */
+static void* sec_reader(void* arg) {
+  // Fill the slots
+  sec_stage(arg,0);
+  return NULL;
+}
+
+/** Runs the writing stage of a pipeline, used as a thread routine. */
+static void* sec_writer(void* arg) {
+  // Empty the slots
+  sec_stage(arg,2);
+  return NULL;
+}
+
+/** Reads, transforms and writes the slots of flow with the given stages, each
+ * slot holding up to most chunks of an archive. The reading and the writing
+ * run in their own threads, so that the input, the transformation and the
+ * output overlap, or in this one if they cannot be started. Returns whether
+ * every stage succeeded. */
+static bool sec_pipeline(CrypStage read, CrypStage transform,
+CrypStage write, CrypFlow* flow, const size_t most) {
+  // Initialize the pipeline and allocate the ring
+  CrypPipe pipe;
+  pipe.stages[0] = read, pipe.stages[1] = transform, pipe.stages[2] = write;
+  pipe.flow = flow, pipe.failed = false;
+  for (int s = 0; s < 3; ++s)
+    pipe.done[s] = 0, pipe.over[s] = false;
+  for (size_t k = 0; k < SEC_SLOTS; ++k) {
+    CrypSlot* slot = pipe.slots+k;
+    slot->text = MALLOC(sizeof(char)*flow->cap);
+    slot->chunks = MALLOC(sizeof(ArcChunk)*MAX(most,1));
+    slot->tags = MALLOC(sizeof(char)*ARC_TAG*MAX(most,1));
+    for (size_t i = 0; i < most; ++i)
+      slot->chunks[i].tag = slot->tags+ARC_TAG*i;
+  }
+  pthread_mutex_init(&pipe.lock,NULL), pthread_cond_init(&pipe.moved,NULL);
+  // Start the writer and then the reader, stopping the first if necessary
+  pthread_t reader, writer;
+  bool threaded = !pthread_create(&writer,NULL,sec_writer,&pipe);
+  if (threaded && pthread_create(&reader,NULL,sec_reader,&pipe)) {
+    pthread_mutex_lock(&pipe.lock);
+    pipe.over[1] = true;
+    pthread_cond_broadcast(&pipe.moved);
+    pthread_mutex_unlock(&pipe.lock);
+    pthread_join(writer,NULL), pipe.over[1] = threaded = false;
+  }
+  // Transform the slots here while the other stages run
+  if (threaded) {
+    sec_stage(&pipe,1);
+    pthread_join(reader,NULL), pthread_join(writer,NULL);
+  }
+  // Or run every stage on a single slot in turn
+  else {
+    CrypSlot* slot = pipe.slots;
+    for (bool more = true; more; ) {
+      pipe.failed = !read(flow,slot), more = !pipe.failed && slot->len;
+      if (more)
+        pipe.failed = !transform(flow,slot) || !write(flow,slot);
+      more = more && !pipe.failed;
+    }
+  }
+  // Free extra memory
+  pthread_mutex_destroy(&pipe.lock), pthread_cond_destroy(&pipe.moved);
+  for (size_t k = 0; k < SEC_SLOTS; ++k)
+    free(pipe.slots[k].text), free(pipe.slots[k].chunks);
+  for (size_t k = 0; k < SEC_SLOTS; ++k)
+    free(pipe.slots[k].tags);
+  // Return whether every stage succeeded
+  return !pipe.failed;
+}
+
+/** Reads the next bytes of the input into slot. */
+static bool sec_readtext(CrypFlow* flow, CrypSlot* slot) {
+  // Fill the slot unless the input is over
+  slot->len = fread(slot->text,1,flow->cap,flow->in);
+  slot->first = flow->next, flow->next += slot->len;
+  // Return whether it succeeded
+  return !ferror(flow->in);
+}
+
+/** Applies the keystream of a legacy file to the bytes of slot. */
+static bool sec_xortext(CrypFlow* flow, CrypSlot* slot) {
+  // Transform the bytes at their offset
+  CrypText data = {slot->text, flow->nonce, slot->len};
+  aes_counter(flow->aes,&data,slot->first,flow->threads);
+  return true;
+}
+
+/** Writes the bytes of slot into the output. */
+static bool sec_writetext(CrypFlow* flow, CrypSlot* slot) {
+  // Return whether every byte was written
+  return fwrite(slot->text,1,slot->len,flow->out) == slot->len;
+}
+
+/** Splits the bytes of slot into the chunks of the archive and encrypts
+ * them. */
+static bool sec_sealtext(CrypFlow* flow, CrypSlot* slot) {
+  // Describe the chunks
+  unsigned char shift = flow->arc->head.shift;
+  size_t size = (size_t)1<<shift;
+  slot->count = (size_t)arc_chunks(slot->len,shift);
+  for (size_t i = 0; i < slot->count; ++i) {
+    slot->chunks[i].text = slot->text+i*size;
+    slot->chunks[i].len = MIN(size,slot->len-i*size);
+  }
+  // Encrypt them as the chunks at that offset
+  arc_seal(flow->arc,slot->chunks,slot->count,slot->first>>shift,
+  flow->threads);
+  return true;
+}
+
+/** Appends the encrypted chunks of slot to the archive. */
+static bool sec_appendtext(CrypFlow* flow, CrypSlot* slot) {
+  // Return whether every chunk was written
+  return arc_append(flow->arc,slot->chunks,slot->count);
+}
+
+/** Reads the next chunks of the archive into slot. */
+static bool sec_taketext(CrypFlow* flow, CrypSlot* slot) {
+  // Read the chunks, which are empty once the archive is over
+  slot->first = flow->arc->count;
+  bool valid = arc_take(flow->arc,slot->text,flow->cap,slot->chunks,
+  &slot->count);
+  slot->len = 0;
+  for (size_t i = 0; i < slot->count; ++i)
+    slot->len += slot->chunks[i].len;
+  // Return whether they were read
+  return valid;
+}
+
+/** Decrypts the chunks of slot, checking their tags. */
+static bool sec_opentext(CrypFlow* flow, CrypSlot* slot) {
+  // Return whether every tag matched
+  return arc_unseal(flow->arc,slot->chunks,slot->count,slot->first,
+  flow->threads);
+}
+
+/** Transforms the rest of the input into the output chunk by chunk, carrying
+ * the counter from one chunk to the next, with the given number of threads,
+ * or all processors if 0, while the next chunk is read and the previous one
+ * is written. Returns whether it succeeded. */
+static bool sec_stream(FILE* in, FILE* out, Aes aes,
+const unsigned long long nonce, const unsigned threads) {
+  // Run the pipeline over the bytes as they are
+  CrypFlow flow = {in, out, NULL, aes, nonce, 0, SEC_CHUNK, threads};
+  return sec_pipeline(sec_readtext,sec_xortext,sec_writetext,&flow,0);
+}
+
+/** Encrypts the input into an archive on the output, reading several chunks
+ * at a time and encrypting them in parallel, along with their tags if it is
+ * authenticated, while the next ones are read and the previous ones are
+ * written. Returns whether it succeeded. */
+static bool sec_pack(FILE* in, FILE* out, const ArcKey key,
+const ArcHead* head, const unsigned threads) {
+  // Write the header
+  Arc arc = arc_create(out,head,key);
+  if (!arc)
+    return false;
+  // Encrypt and append groups of chunks, one for each thread at least
+  size_t size = (size_t)1<<head->shift;
+  size_t cap = MAX(SEC_CHUNK,size*((threads) ? threads : aes_cores()));
+  CrypFlow flow = {in, out, arc, NULL, head->nonce, 0, cap, threads};
+  bool success = sec_pipeline(sec_readtext,sec_sealtext,sec_appendtext,&flow,
+  cap>>head->shift) && arc_finish(arc);
+  // Free extra memory
+  arc_delete(arc);
+  // Return whether the whole input was encrypted
+  return success;
+}
+
+/** Decrypts the chunks of an archive into the output, gathering several of
+ * them and decrypting them in parallel, after checking their tags if it is
+ * authenticated, while the next ones are read and the previous ones are
+ * written. Returns whether it succeeded. */
+static bool sec_unpack(Arc arc, FILE* out, const unsigned threads) {
+  // Decrypt and write groups of chunks, one for each thread at least
+  size_t size = (size_t)1<<arc->head.shift;
+  size_t cap = MAX(SEC_CHUNK,size*((threads) ? threads : aes_cores()));
+  CrypFlow flow = {arc->fp, out, arc, NULL, arc->head.nonce, 0, cap, threads};
+  return sec_pipeline(sec_taketext,sec_opentext,sec_writetext,&flow,
+  cap>>arc->head.shift);
+}
+
+#if SEC_MMAP
+
+/** Gets the size of the input and whether the output is the same file. */
+static bool sec_stat(FILE* in, FILE* out, size_t* size, bool* same) {
+  // Compare the devices and the nodes of both files
+  struct stat ist, ost;
+  if (fstat(fileno(in),&ist) || fstat(fileno(out),&ost))
+    return false;
+  *same = ist.st_dev == ost.st_dev && ist.st_ino == ost.st_ino;
+  *size = (size_t)ist.st_size;
+  // Return success
+  return true;
+}
+
+/** Maps the input, of size bytes, for reading and the output, resized to
+ * total bytes, for reading and writing. When both are the same file, a
+ * single mapping spanning both sizes is shared and the file only grows.
+ * Returns whether it succeeded. */
+static bool sec_map(FILE* in, FILE* out, const size_t size, const size_t total,
+const bool same, unsigned char** src, unsigned char** dst) {
+  // Resize the output unless it shrinks in place
+  int fd = fileno(out);
+  size_t span = (same) ? MAX(size,total) : total;
+  *src = *dst = NULL;
+  if ((!same || total > size) && ftruncate(fd,(off_t)total))
+    return false;
+  // Map the output, which is also the input if they are the same
+  if (span && (*dst = mmap(NULL,span,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))
+  == MAP_FAILED)
+    return *dst = NULL, false;
+  if (same)
+    return *src = *dst, true;
+  // Map the input apart otherwise
+  if (size && (*src = mmap(NULL,size,PROT_READ,MAP_SHARED,fileno(in),0)) ==
+  MAP_FAILED) {
+    if (*dst)
+      munmap(*dst,span);
+    return *src = *dst = NULL, false;
+  }
+  // Return success
+  return true;
+}
+
+/** Unmaps the files mapped by sec_map, shrinking the output to total bytes
+ * if it is the input. Returns whether it succeeded. */
+static bool sec_unmap(FILE* out, unsigned char* src, unsigned char* dst,
+const size_t size, const size_t total, const bool same) {
+  // Unmap the output and the input
+  bool success = !dst || !munmap(dst,(same) ? MAX(size,total) : total);
+  if (!same && src)
+    success = !munmap(src,size) && success;
+  // Fix the final size
+  if (same && total < size)
+    success = !ftruncate(fileno(out),(off_t)total) && success;
+  // Return whether it succeeded
+  return success;
+}
+
+/** Encrypts the input into an archive on the output through shared memory
+ * mappings. The chunks are spread from the last one, so that none overwrites
+ * another that has not been moved yet when both files are the same, and then
+ * encrypted in place. Returns whether it succeeded. */
+static bool sec_mappack(FILE* in, FILE* out, const ArcKey key,
+const ArcHead* head, const unsigned threads) {
+  // Map both files, with room for the whole archive
+  size_t size, total;
+  bool same;
+  unsigned char *src, *dst;
+  if (!sec_stat(in,out,&size,&same))
+    return false;
+  total = (size_t)arc_size(head,size);
+  if (!sec_map(in,out,size,total,same,&src,&dst))
+    return false;
+  // Move each chunk to its record, leaving room for its tag
+  size_t chunk = (size_t)1<<head->shift;
+  size_t count = (size_t)arc_chunks(size,head->shift);
+  ArcChunk* chunks = MALLOC(sizeof(ArcChunk)*MAX(count,1));
+  for (size_t i = count; i--; ) {
+    chunks[i].text = dst+arc_offset(head,i)+ARC_PREFIX;
+    chunks[i].len = MIN(chunk,size-i*chunk);
+    chunks[i].tag = chunks[i].text+chunks[i].len;
+    memmove(chunks[i].text,src+i*chunk,chunks[i].len);
+  }
+  // Encrypt the chunks and write everything around them
+  Arc arc = arc_open(NULL,head,key);
+  arc_seal(arc,chunks,count,0,threads), arc_frame(arc,dst,size);
+  // Free extra memory
+  free(chunks), arc_delete(arc);
+  // Return whether the files were unmapped
+  return sec_unmap(out,src,dst,size,total,same);
+}
+
+/** Decrypts an archive, whose index is loaded, into the output through
+ * shared memory mappings. The chunks are decrypted in place and gathered
+ * from the first one when both files are the same, and gathered before being
+ * decrypted otherwise. If any tag does not match, the input is left as it
+ * was. Returns whether it succeeded. */
+static bool sec_mapunpack(FILE* in, FILE* out, Arc arc,
+const unsigned threads) {
+  // Map both files, with room for the plaintext
+  size_t size, total = (size_t)arc->len;
+  bool same;
+  unsigned char *src, *dst;
+  if (!sec_stat(in,out,&size,&same) ||
+  arc->pos+8*arc->count+arc_tail(&arc->head) != size ||
+  !sec_map(in,out,size,total,same,&src,&dst))
+    return false;
+  // Check the length of every chunk before moving any
+  size_t chunk = (size_t)1<<arc->head.shift;
+  ArcChunk* chunks = MALLOC(sizeof(ArcChunk)*MAX(arc->count,1));
+  unsigned long long end = ARC_HEAD;
+  bool success = true;
+  for (size_t i = 0; success && i < arc->count; ++i) {
+    size_t len = MIN(chunk,total-i*chunk);
+    success = arc->offs[i] >= end &&
+    arc_getword(src+arc->offs[i],ARC_PREFIX) == len;
+    end = arc->offs[i]+arc_record(&arc->head,len);
+    chunks[i].text = src+arc->offs[i]+ARC_PREFIX, chunks[i].len = len;
+    chunks[i].tag = chunks[i].text+len;
+  }
+  success = success && end+ARC_PREFIX <= arc->pos;
+  // Gather the chunks of another file before decrypting them
+  for (size_t i = 0; success && !same && i < arc->count; ++i) {
+    memcpy(dst+i*chunk,chunks[i].text,chunks[i].len);
+    chunks[i].text = dst+i*chunk;
+  }
+  success = success && arc_unseal(arc,chunks,arc->count,0,threads);
+  for (size_t i = 0; success && same && i < arc->count; ++i)
+    memmove(dst+i*chunk,chunks[i].text,chunks[i].len);
+  // Free extra memory
+  free(chunks);
+  // Return whether the files were unmapped
+  return sec_unmap(out,src,dst,size,(success || !same) ? total : size,same)
+  && success;
+}
+
+/** Decrypts a legacy file, made of the nonce and the ciphertext, into the
+ * output through shared memory mappings. When both are the same file, the
+ * text is shifted inside a single mapping. Returns whether it succeeded. */
+static bool sec_maplegacy(FILE* in, FILE* out, Aes aes,
+const unsigned long long nonce, const unsigned threads) {
+  // Map both files, with room for the text
+  size_t size, total;
+  bool same;
+  unsigned char *src, *dst;
+  if (!sec_stat(in,out,&size,&same) || size < 8)
+    return false;
+  total = size-8;
+  if (!sec_map(in,out,size,total,same,&src,&dst))
+    return false;
+  // Drop the nonce and decrypt the text in place
+  CrypText data = {dst, nonce, total};
+  if (total)
+    memmove(dst,src+8,total), aes_counter(aes,&data,0,threads);
+  // Return whether the files were unmapped
+  return sec_unmap(out,src,dst,size,total,same);
+}
+
+#else
+
+/** Memory mappings are not available, so nothing can be encrypted. */
+static bool sec_mappack(FILE* in, FILE* out, const ArcKey key,
+const ArcHead* head, const unsigned threads) {
+  // Return failure
+  (void)in, (void)out, (void)key, (void)head, (void)threads;
+  return false;
+}
+
+/** Memory mappings are not available, so nothing can be decrypted. */
+static bool sec_mapunpack(FILE* in, FILE* out, Arc arc,
+const unsigned threads) {
+  // Return failure
+  (void)in, (void)out, (void)arc, (void)threads;
+  return false;
+}
+
+/** Memory mappings are not available, so nothing can be decrypted. */
+static bool sec_maplegacy(FILE* in, FILE* out, Aes aes,
+const unsigned long long nonce, const unsigned threads) {
+  // Return failure
+  (void)in, (void)out, (void)aes, (void)nonce, (void)threads;
+  return false;
+}
+
+#endif // SEC_MMAP
+
+/** Transforms the input into the output with the contexts keys as op says,
+ * through memory mappings if chosen. To decrypt, the archive arc must be
+ * open, or NULL for a legacy file. Each file uses the given number of
+ * threads, or all processors if 0. Returns whether it succeeded. */
+static bool sec_transform(FILE* in, FILE* out, ArcKey* keys, Arc arc,
+const unsigned long long nonce, const CrypOp op, const CrypOpts* opts,
+const unsigned threads) {
+  // Write the archive with the chosen cipher
+  ArcHead head = {ARC_VERSION, (opts->chacha) ? ARC_CHACHA :
+  arc_cipher(opts->size), (unsigned char)(((opts->authenticated) ? ARC_AUTH :
+  0)|((opts->compressed) ? ARC_LZ : 0)), ARC_SHIFT, nonce};
+  if (op == ENCRYPT && opts->mapped)
+    return sec_mappack(in,out,keys[head.cipher],&head,threads);
+  if (op == ENCRYPT)
+    return sec_pack(in,out,keys[head.cipher],&head,threads);
+  // Or write the plaintext
+  if (arc && opts->mapped)
+    return sec_mapunpack(in,out,arc,threads);
+  if (arc)
+    return sec_unpack(arc,out,threads);
+  AesGcm gcm = keys[ARC_AES256].gcm;
+  if (opts->mapped)
+    return sec_maplegacy(in,out,&gcm->aes,nonce,threads);
+  return sec_stream(in,out,&gcm->aes,nonce,threads);
+}
+
+/** Closes both files, moving the temporary output to its place if there is one
+ * and everything succeeded, or discarding it otherwise. Returns whether
+ * everything succeeded until the end. */
+static bool sec_close(FILE* in, FILE* out, Str name, Str temp, bool success) {
+  // Close the files
+  fclose(in);
+  success = !fclose(out) && success;
+  // Move the temporary file to its place, or discard it if there was an error
+  if (temp) {
+    Str dest = str_copy(temp);
+    str_delete(str_div(dest,dest->len-strlen(SEC_TEMP)));
+    if (success)
+      remove(dest->word), success = !rename(temp->word,dest->word);
+    else
+      remove(temp->word);
+    str_delete(temp), str_delete(dest);
+  }
+  // Free extra memory
+  str_delete(name);
+  // Return whether it succeeded
+  return success;
+}
+
+/** Wipes and frees the used key. */
+static void sec_freekey(unsigned char* key) {
+  // Overwrite the key before freeing it
+  for (size_t i = 0; i < 32; ++i)
+    key[i] = '\0';
+  free(key);
+}
+
+/** Expands key, padded with zeros to 32 bytes, into a context for each
+ * cipher of the archives in keys, leaving both contexts NULL for those whose
+ * key is too short to hold it, and wipes and frees the key. */
+static void sec_expand(unsigned char* key, ArcKey keys[ARC_CIPHERS]) {
+  // Check the padding beyond the size of each key
+  for (unsigned char c = 0; c < ARC_CIPHERS; ++c) {
+    size_t size = arc_keysize(c), i = size;
+    for (; i < 32 && !key[i]; ++i);
+    keys[c].gcm = NULL, keys[c].chacha = NULL;
+    if (i == 32 && c == ARC_CHACHA)
+      keys[c].chacha = chacha_create(key);
+    else if (i == 32)
+      keys[c].gcm = aes_gcmcreate(key,(AesSize)size);
+  }
+  // Free the key, which is no longer needed
+  sec_freekey(key);
+}
+
+/** Wipes and frees the contexts of keys. */
+static void sec_release(ArcKey keys[ARC_CIPHERS]) {
+  // Delete every context that was created
+  for (int c = 0; c < ARC_CIPHERS; ++c) {
+    if (keys[c].gcm)
+      aes_gcmdelete(keys[c].gcm);
+    if (keys[c].chacha)
+      chacha_delete(keys[c].chacha);
+  }
+}
+
 /** Encrypts a text with a key and a nonce. */
-static void sec_encrypt(void) {
+static int sec_encrypt(const CrypOpts* opts) {
   // Get valid key
-  unsigned char* key = sec_getkey();
+  unsigned char* key = sec_getkey(opts->size);
   // Get valid nonce
-  unsigned long long nonce = sec_getnonce();
+  unsigned long long nonce;
+  if (!sec_getnonce(&nonce)) {
+    sec_freekey(key), fputs("ERROR: Nonce cannot be drawn.\n",stderr);
+    return EXIT_FAILURE;
+  }
   // Get input file and open it
-  Str name;
-  FILE* file = sec_getinput(&name);
-  // Get the encryption data
-  CrypText* data = sec_getdata(file,nonce);
-  // Encrypt the plaintext
-  aes_transform(data,key);
-  // Free the used key
-  for (size_t i = 0; i < 32; ++i)
-    key[i] = '\0';
-  free(key);
+  Str name, temp;
+  FILE* in = sec_getinput(&name);
   // Get and open output file
-  file = sec_getoutput(name);
-  // Write the nonce and the ciphertext
-  for (int i = 7; i >= 0; --i)
-    fputc((int)(nonce>>(i<<3)),file);
-  for (size_t i = 0; i < data->len; ++i)
-    fputc(data->text[i],file);
-  // Free extra memory
-  fclose(file);
-  if (data->text)
-    free(data->text);
-  free(data);
+  FILE* out = sec_getoutput(name,&temp,opts->mapped);
+  // Expand the key, which is no longer needed
+  ArcKey keys[ARC_CIPHERS];
+  sec_expand(key,keys);
+  // Write the archive
+  bool success = sec_transform(in,out,keys,NULL,nonce,ENCRYPT,opts,0);
+  // Free the cipher contexts and close the files
+  sec_release(keys);
+  if (!sec_close(in,out,name,temp,success)) {
+    fputs("ERROR: Output file cannot be written.\n",stderr);
+    return EXIT_FAILURE;
+  }
+  // Return exit code
+  return EXIT_SUCCESS;
 }
 
-/** Gets the nonce from an encrypted file. */
-static unsigned long long sec_getusednonce(FILE* file, bool* success) {
+/** Gets the header of an encrypted file, which is an archive unless it only
+ * starts with the nonce, as legacy files do. In the first case, the archive is
+ * opened with the context in keys of its cipher, which fails if the key does
+ * not fit it, and its index is loaded if mapped, which fails if it is
+ * compressed, otherwise arc is NULL, which fails if the options require an
+ * authenticated archive. A legacy file whose nonce starts like the magic bytes
+ * is still read as one when the rest of its header is not valid, but taken for
+ * an archive when it is, since both cannot be told apart. */
+static unsigned long long sec_getusednonce(FILE* file, Arc* arc,
+ArcKey* keys, const CrypOpts* opts, bool* success) {
   // Initialize the nonce
   unsigned long long nonce = 0;
+  *arc = NULL;
   // Read first 8 bytes if possible
-  for (int i = 7; *success && i >= 0; --i) {
-    int c = fgetc(file);
-    if ((*success = c != EOF))
-      nonce |= (unsigned long long)(c<<(i<<3));
+  unsigned char head[ARC_HEAD];
+  if (!(*success = fread(head,1,8,file) == 8))
+    return nonce;
+  for (int i = 0; i < 8; ++i)
+    nonce = nonce<<8|head[i];
+  // Read the rest of the header of an archive
+  if (arc_check(head)) {
+    ArcHead settings;
+    bool valid = fread(head+8,1,ARC_HEAD-8,file) == ARC_HEAD-8 &&
+    arc_gethead(head,&settings);
+    *success = valid &&
+    (keys[settings.cipher].gcm || keys[settings.cipher].chacha);
+    if (*success) {
+      *arc = arc_open(file,&settings,keys[settings.cipher]);
+      nonce = settings.nonce;
+      *success = !opts->mapped ||
+      (!(settings.flags&ARC_LZ) && arc_index(*arc));
+    }
+    // Otherwise take it for a legacy file whose nonce starts like the magic
+    // bytes, going back to its ciphertext
+    else if (!valid)
+      *success = !fseek(file,8,SEEK_SET);
   }
+  // Check that the file is authenticated if required
+  *success = *success &&
+  (!opts->authenticated || (*arc && (*arc)->head.flags&ARC_AUTH));
   // Return the nonce
   return nonce;
 }
 
 /** Decrypts a text with a key. */
-static int sec_decrypt(void) {
-  // Get valid key
-  unsigned char* key = sec_getkey();
+static int sec_decrypt(const CrypOpts* opts) {
+  // Get valid key and expand it
+  ArcKey keys[ARC_CIPHERS];
+  sec_expand(sec_getkey(opts->size),keys);
   // Get input file and open it
-  Str name;
-  FILE* file = sec_getinput(&name);
-  // Get the used nonce from the file
+  Str name, temp;
+  FILE* in = sec_getinput(&name);
+  // Get the used header from the file
   bool success = true;
-  unsigned long long nonce = sec_getusednonce(file,&success);
+  Arc arc;
+  unsigned long long nonce = sec_getusednonce(in,&arc,keys,opts,&success);
   // Exit execution if an error was encountered
   if (!success) {
-    fclose(file), fputs("ERROR: Input file cannot be decrypted.\n",stderr);
-    for (size_t i = 0; i < 32; ++i)
-      key[i] = '\0';
-    free(key), str_delete(name);
+    fclose(in), fputs("ERROR: Input file cannot be decrypted.\n",stderr);
+    sec_release(keys), str_delete(name);
+    if (arc)
+      arc_delete(arc);
     return EXIT_FAILURE;
   }
-  // Get the decryption data
-  CrypText* data = sec_getdata(file,nonce);
-  // Decrypt the ciphertext
-  aes_transform(data,key);
-  // Free the used key
-  for (size_t i = 0; i < 32; ++i)
-    key[i] = '\0';
-  free(key);
   // Get and open output file
-  file = sec_getoutput(name);
+  FILE* out = sec_getoutput(name,&temp,opts->mapped);
   // Write the plaintext
-  for (size_t i = 0; i < data->len; ++i)
-    fputc(data->text[i],file);
-  // Free extra memory
-  fclose(file);
-  if (data->text)
-    free(data->text);
-  free(data);
+  success = sec_transform(in,out,keys,arc,nonce,DECRYPT,opts,0);
+  // Free the cipher contexts and close the files
+  sec_release(keys);
+  if (arc)
+    arc_delete(arc);
+  bool invalid = !success && !ferror(out);
+  if (!sec_close(in,out,name,temp,success)) {
+    fputs((invalid) ? "ERROR: Input file cannot be decrypted.\n" :
+    "ERROR: Output file cannot be written.\n",stderr);
+    return EXIT_FAILURE;
+  }
   // Return exit code
   return EXIT_SUCCESS;
 }
 
+/** Gets the size of file, moving its position back to the start. */
+static unsigned long long sec_length(FILE* file) {
+  // Go to the end and get the position there
+#if defined(_WIN32)
+  long long end = (_fseeki64(file,0,SEEK_END)) ? 0 : _ftelli64(file);
+#else
+  off_t end = (fseeko(file,0,SEEK_END)) ? 0 : ftello(file);
+#endif // _WIN32
+  rewind(file);
+  // Return the size
+  return (end > 0) ? (unsigned long long)end : 0;
+}
+
+/** Transforms a file of a batch, storing the reason if it fails. */
+static void sec_job(CrypBatch* batch, CrypJob* job) {
+  // Open the input and get its header or draw a nonce
+  FILE* in = fopen(job->in->word,"rb");
+  if (!in) {
+    job->error = "cannot be opened";
+    return;
+  }
+  job->bytes = sec_length(in);
+  bool success = true;
+  Arc arc = NULL;
+  unsigned long long nonce;
+  if (batch->op == DECRYPT)
+    nonce = sec_getusednonce(in,&arc,batch->keys,batch->opts,&success);
+  else
+    success = sec_drawnonce(&nonce);
+  // Open the output
+  Str temp = NULL;
+  FILE* out = (success) ? sec_openoutput(job->in,str_copy(job->out),&temp,
+  batch->opts->mapped) : NULL;
+  if (!out) {
+    job->error = (!success && batch->op == DECRYPT) ? "cannot be decrypted" :
+    (!success) ? "cannot get a nonce" : "has an output that cannot be opened";
+    fclose(in);
+    if (arc)
+      arc_delete(arc);
+    return;
+  }
+  // Transform the file and close both files
+  success = sec_transform(in,out,batch->keys,arc,nonce,batch->op,
+  batch->opts,batch->threads);
+  bool invalid = !success && batch->op == DECRYPT && !ferror(out);
+  if (arc)
+    arc_delete(arc);
+  if (!sec_close(in,out,str_copy(job->in),temp,success))
+    job->error = (invalid) ? "cannot be decrypted" :
+    "has an output that cannot be written";
+}
+
+/** Takes the files of a batch one by one and transforms them, printing the
+ * status of each one, used as a thread routine. */
+static void* sec_worker(void* arg) {
+  // Take the next file until there are none left
+  CrypBatch* batch = arg;
+  for (;;) {
+    pthread_mutex_lock(&batch->lock);
+    size_t i = batch->next;
+    batch->next += i < batch->count;
+    pthread_mutex_unlock(&batch->lock);
+    if (i == batch->count)
+      return NULL;
+    // Transform the file and print its status
+    CrypJob* job = batch->jobs+i;
+    sec_job(batch,job);
+    pthread_mutex_lock(&batch->lock);
+    if (job->error)
+      fprintf(stderr,"ERROR: %s %s.\n",job->in->word,job->error);
+    else
+      printf("%s: %llu bytes done.\n",job->in->word,job->bytes);
+    pthread_mutex_unlock(&batch->lock);
+  }
+}
+
+/** Reads the key, of at most the key size of the options, from the first
+ * line of their key file and expands it into keys, or returns false after
+ * printing the error if it cannot. */
+static bool sec_readkey(const CrypOpts* opts, ArcKey keys[ARC_CIPHERS]) {
+  // Read the first line of the key file
+  FILE* file = fopen(opts->keyfile,"rb");
+  if (!file) {
+    fputs("ERROR: Key file cannot be opened.\n",stderr);
+    return false;
+  }
+  Str line = str_get(file,false);
+  fclose(file);
+  // Check if key is valid
+  if (line->len > (size_t)opts->size) {
+    fprintf(stderr,"ERROR: Key cannot exceed %d bytes long.\n",
+    (int)opts->size);
+    str_delete(line);
+    return false;
+  }
+  // Expand the key, which is no longer needed
+  sec_expand(sec_fixkey(line),keys);
+  // Return success
+  return true;
+}
+
+/** Transforms every file listed in stdin as op says, with the key in the key
+ * file of the options, printing a summary at the end. */
+static int sec_batch(const CrypOp op, const CrypOpts* opts) {
+  // Get the cipher contexts
+  CrypBatch batch;
+  if (!sec_readkey(opts,batch.keys))
+    return EXIT_FAILURE;
+  batch.op = op, batch.opts = opts;
+  // Read the files from stdin, skipping empty lines
+  size_t cap = 16;
+  batch.jobs = MALLOC(sizeof(CrypJob)*cap), batch.count = batch.next = 0;
+  while (!feof(stdin)) {
+    Str line = str_get(stdin,false);
+    if (!line->len) {
+      str_delete(line);
+      continue;
+    }
+    if (batch.count == cap)
+      batch.jobs = REALLOC(batch.jobs,sizeof(CrypJob)*(cap<<=1));
+    // Split the output from the input at the first tab
+    char* tab = strchr(line->word,'\t');
+    Str out = (tab) ? str_div(line,(size_t)(tab-line->word)+1) :
+    str_create("");
+    if (tab)
+      str_truncate(line);
+    batch.jobs[batch.count++] = (CrypJob){line, out, 0, NULL};
+  }
+  // Share the processors among the workers
+  unsigned cores = aes_cores();
+  size_t workers = MAX(MIN(cores,batch.count),1);
+  batch.threads = (unsigned)MAX(cores/workers,1);
+  pthread_mutex_init(&batch.lock,NULL);
+  pthread_t* ids = MALLOC(sizeof(pthread_t)*workers);
+  bool* started = MALLOC(sizeof(bool)*workers);
+  // Transform the files in this thread and in the rest of workers
+  struct timespec start, stop;
+  timespec_get(&start,TIME_UTC);
+  for (size_t w = 1; w < workers; ++w)
+    started[w] = !pthread_create(ids+w,NULL,sec_worker,&batch);
+  sec_worker(&batch);
+  for (size_t w = 1; w < workers; ++w)
+    if (started[w])
+      pthread_join(ids[w],NULL);
+  timespec_get(&stop,TIME_UTC);
+  // Print the summary
+  size_t failed = 0;
+  unsigned long long bytes = 0;
+  for (size_t i = 0; i < batch.count; ++i) {
+    failed += batch.jobs[i].error != NULL;
+    bytes += (batch.jobs[i].error) ? 0 : batch.jobs[i].bytes;
+    str_delete(batch.jobs[i].in), str_delete(batch.jobs[i].out);
+  }
+  double secs = (double)(stop.tv_sec-start.tv_sec)+
+  (double)(stop.tv_nsec-start.tv_nsec)/1e9;
+  printf("%zu files, %zu failed, %llu bytes in %.3f s (%.1f MB/s).\n",
+  batch.count,failed,bytes,secs,(secs > 0) ? (double)bytes/secs/1e6 : 0.0);
+  // Free extra memory
+  pthread_mutex_destroy(&batch.lock), sec_release(batch.keys);
+  free(batch.jobs), free(ids), free(started);
+  // Return exit code
+  return (failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/** Prepares a standard stream of a filter to carry binary data, enlarging
+ * it if it is a pipe so that every transfer moves more bytes. */
+static void sec_pipe(FILE* file) {
+  // Switch to binary mode or request a larger pipe
+#if defined(_WIN32)
+  _setmode(_fileno(file),_O_BINARY);
+#elif defined(F_SETPIPE_SZ)
+  fcntl(fileno(file),F_SETPIPE_SZ,(int)SEC_PIPE);
+#else
+  (void)file;
+#endif // _WIN32
+}
+
+/** Transforms stdin into stdout as op says, with the key in the key file of
+ * the options, streaming the data without seeking either of them. */
+static int sec_filter(const CrypOp op, const CrypOpts* opts) {
+  // Get the cipher contexts and prepare the streams
+  ArcKey keys[ARC_CIPHERS];
+  if (!sec_readkey(opts,keys))
+    return EXIT_FAILURE;
+  sec_pipe(stdin), sec_pipe(stdout);
+  // Get the used header or draw a nonce
+  bool success = true;
+  Arc arc = NULL;
+  unsigned long long nonce;
+  if (op == DECRYPT)
+    nonce = sec_getusednonce(stdin,&arc,keys,opts,&success);
+  else
+    success = sec_drawnonce(&nonce);
+  bool ready = success;
+  // Transform the data
+  if (success)
+    success = sec_transform(stdin,stdout,keys,arc,nonce,op,opts,0);
+  success = !fflush(stdout) && success;
+  // Free the cipher contexts
+  bool written = !ferror(stdout);
+  sec_release(keys);
+  if (arc)
+    arc_delete(arc);
+  // Return exit code
+  if (success)
+    return EXIT_SUCCESS;
+  if (!ready && op == ENCRYPT)
+    fputs("ERROR: Nonce cannot be drawn.\n",stderr);
+  else if (written && op == DECRYPT)
+    fputs("ERROR: Input cannot be decrypted.\n",stderr);
+  else
+    fputs((written) ? "ERROR: Input cannot be read.\n" :
+    "ERROR: Output cannot be written.\n",stderr);
+  return EXIT_FAILURE;
+}
+
 //_____________________________________________________________________________
 
 // ------ MAIN ------ //
@@ -246,10 +1149,8 @@ int main(int argc, char** argv) {
   // Initialize option
   CrypOp option = NONE;
   if (argc > 1) {
-    if (argc > 2)
-      option = MANY;
-    else if (!strcmp(argv[1],"-h"))
-      option = HELP;
+    if (!strcmp(argv[1],"-h"))
+      option = (argc > 2) ? MANY : HELP;
     else if (!strcmp(argv[1],"-e"))
       option = ENCRYPT;
     else if (!strcmp(argv[1],"-d"))
@@ -257,6 +1158,29 @@ int main(int argc, char** argv) {
     else
       option = INVALID;
   }
+  // Initialize flags
+  CrypOpts opts = {false, false, AES_256, false, false, NULL, false};
+  for (int i = 2; i < argc && option > HELP; ++i) {
+    if (!strcmp(argv[i],"-m") && SEC_MMAP)
+      opts.mapped = true;
+    else if (!strcmp(argv[i],"-a"))
+      opts.authenticated = true;
+    else if (!strcmp(argv[i],"-k") && i+1 < argc && option == ENCRYPT)
+      option = sec_keysize(argv[++i],&opts.size) ? option : INVALID;
+    else if (!strcmp(argv[i],"-c") && option == ENCRYPT)
+      opts.chacha = true;
+    else if (!strcmp(argv[i],"-z") && option == ENCRYPT)
+      opts.compressed = true;
+    else if ((!strcmp(argv[i],"-b") || !strcmp(argv[i],"-f")) && i+1 < argc
+    && !opts.keyfile)
+      opts.filter = argv[i][1] == 'f', opts.keyfile = argv[++i];
+    else
+      option = INVALID;
+  }
+  if ((opts.filter || opts.compressed) && opts.mapped)
+    option = INVALID;
+  if (opts.chacha && (opts.size != AES_256 || opts.authenticated))
+    option = INVALID;
   // Continue execution according to chosen mode
   int ret = EXIT_SUCCESS;
   switch (option) {
@@ -274,11 +1198,13 @@ int main(int argc, char** argv) {
       break;
     // Encrypt a file
     case ENCRYPT:
-      sec_encrypt();
+      ret = (opts.filter) ? sec_filter(option,&opts) : (opts.keyfile) ?
+      sec_batch(option,&opts) : sec_encrypt(&opts);
       break;
     // Decrypt a file
     case DECRYPT:
-      ret = sec_decrypt();
+      ret = (opts.filter) ? sec_filter(option,&opts) : (opts.keyfile) ?
+      sec_batch(option,&opts) : sec_decrypt(&opts);
       break;
     // No arguments
     default:
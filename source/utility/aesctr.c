@@ -1,5 +1,5 @@
 /// SOURCE - ENCRYPTION
-/** Source file for an AES-CTR 256-bit key implementation. */
+/** Source file for an AES-CTR implementation with keys of 128 to 256 bits. */
 #ifndef __AESCTR_C__
 #define __AESCTR_C__
 
@@ -8,6 +8,93 @@
 // ------ INCLUDES ------ //
 
 #include "../../include/aesctr.h"
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+//_____________________________________________________________________________
+
+// ------ MACROS ------ //
+
+/** Indicates if the hardware implementations are available to compile. */
+#ifndef AES_X86
+#if defined(__x86_64__) || defined(__i386__)
+#define AES_X86 1
+#else
+#define AES_X86 0
+#endif // __x86_64__ || __i386__
+#endif // AES_X86
+
+/** Number of blocks encrypted at the same time by the hardware. */
+#ifndef AES_LANES
+#define AES_LANES ((size_t)8)
+#endif // AES_LANES
+
+/** Number of blocks encrypted at the same time by the bitsliced code. */
+#ifndef AES_SLICES
+#define AES_SLICES ((size_t)16)
+#endif // AES_SLICES
+
+/** Number of blocks of keystream generated at once in counter mode. */
+#ifndef AES_BATCH
+#define AES_BATCH ((size_t)64)
+#endif // AES_BATCH
+
+/** Minimum number of bytes worth handing to a separate thread. */
+#ifndef AES_MINSPLIT
+#define AES_MINSPLIT ((size_t)1<<16)
+#endif // AES_MINSPLIT
+
+/** Applies an inner round to the column c of state s, stored in t. */
+#ifndef AES_COLUMN
+#define AES_COLUMN(t,s,k,c) \
+  ((t)[c] = te0[(s)[c]>>24]^te1[(s)[((c)+1)&3]>>16&0xff]^\
+  te2[(s)[((c)+2)&3]>>8&0xff]^te3[(s)[((c)+3)&3]&0xff]^(k)[c])
+#endif // AES_COLUMN
+
+/** Applies an inner round to the state s, stored in t. */
+#ifndef AES_ROUND
+#define AES_ROUND(t,s,k) \
+  (AES_COLUMN(t,s,k,0),AES_COLUMN(t,s,k,1),AES_COLUMN(t,s,k,2), \
+  AES_COLUMN(t,s,k,3))
+#endif // AES_ROUND
+
+/** Calls f with the given arguments followed by rounds as a constant, so that
+ * each key size gets its own code with the rounds fully unrolled. */
+#ifndef AES_UNROLL
+#define AES_UNROLL(f,rounds,...) \
+  (((rounds) == 10) ? f(__VA_ARGS__,10) : \
+  ((rounds) == 12) ? f(__VA_ARGS__,12) : f(__VA_ARGS__,14))
+#endif // AES_UNROLL
+
+/** Derives the even round key i of the n AES-NI key schedules k. */
+#ifndef AES_NIEVEN
+#define AES_NIEVEN(k,n,i,rcon) \
+  for (size_t _j = 0; _j < (n); ++_j) \
+    (k)[_j][i] = aes_nistep((k)[_j][(i)-2],_mm_shuffle_epi32( \
+    _mm_aeskeygenassist_si128((k)[_j][(i)-1],rcon),0xff))
+#endif // AES_NIEVEN
+
+/** Derives the odd round key i of the n AES-NI key schedules k. */
+#ifndef AES_NIODD
+#define AES_NIODD(k,n,i) \
+  for (size_t _j = 0; _j < (n); ++_j) \
+    (k)[_j][i] = aes_nistep((k)[_j][(i)-2],_mm_shuffle_epi32( \
+    _mm_aeskeygenassist_si128((k)[_j][(i)-1],0),0xaa))
+#endif // AES_NIODD
+
+/** Xors the text with the stream from byte i on, in registers of type vec
+ * of w bytes while whole ones fit, with the given operations. */
+#ifndef AES_XORLOOP
+#define AES_XORLOOP(text,stream,len,i,w,vec,load,store,eor) \
+  for (; (i)+(w) <= (len); (i) += (w)) \
+    store((vec*)((text)+(i)),eor(load((const vec*)((text)+(i))), \
+    load((const vec*)((stream)+(i)))))
+#endif // AES_XORLOOP
+
+#if AES_X86
+#include <immintrin.h>
+#endif // AES_X86
 
 //_____________________________________________________________________________
 
@@ -250,165 +337,1114 @@ static const uint32_t te4[256] = {
 
 /** Constant values for the algorithm. */
 static const uint32_t rcon[] = {
-  16777216, 33554432, 67108864, 134217728, 268435456, 536870912, 1073741824
+  16777216, 33554432, 67108864, 134217728, 268435456, 536870912, 1073741824,
+  2147483648, 452984832, 905969664
+};
+
+/** Reductions of the four bits shifted out of a GHASH product. */
+static const uint16_t ghr[16] = {
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
 };
 
 //_____________________________________________________________________________
 
+// ------ TYPES ------ //
+
+/** Bit planes of AES_SLICES/4 lanes of four blocks each. */
+typedef uint64_t AesSlice __attribute__((vector_size(2*AES_SLICES)));
+
+/** Range of a text transformed by a single thread. */
+typedef struct _AesRange {
+  Aes aes; // cipher context
+  unsigned long long nonce, count; // IV of the first block of the range
+  unsigned char* text; // start of the range
+  size_t len; // length of the range
+} /** Text range type alias. */ AesRange;
+
+//_____________________________________________________________________________
+
+// ------ VARIABLES ------ //
+
+/** Implementation used by the block cipher, negative until it is chosen,
+ * atomic since aes_select may replace it while other threads read it. */
+static _Atomic int aesimpl = -1;
+
+/** Guard that chooses the implementation once. */
+static pthread_once_t aesimplonce = PTHREAD_ONCE_INIT;
+
+#if AES_X86
+
+/** Bytes of the widest registers used to xor a stream, negative until they
+ * are chosen. */
+static int aesxor = -1;
+
+/** Guard that chooses the registers to xor a stream once. */
+static pthread_once_t aesxoronce = PTHREAD_ONCE_INIT;
+
+#endif // AES_X86
+
+//_____________________________________________________________________________
+
+// ------ STATICS ------ //
+
+#if AES_X86
+
+/** Loads the expanded key rk of the given rounds as AES-NI round keys. */
+__attribute__((target("aes,ssse3"),always_inline))
+static inline void aes_niload(const uint32_t rk[60], __m128i k[15],
+const int rounds) {
+  // Swap the bytes of every word, since rk stores them in big endian
+  const __m128i swap = _mm_set_epi8(12,13,14,15,8,9,10,11,4,5,6,7,0,1,2,3);
+  for (int i = 0; i <= rounds; ++i)
+    k[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rk+4*i)),swap);
+}
+
+/** Encrypts n consecutive 128-bit blocks with AES-NI instructions, for a
+ * constant number of rounds. */
+__attribute__((target("aes,ssse3"),always_inline))
+static inline void aes_nirounds(const uint32_t rk[60], unsigned char* pb,
+const size_t n, const int rounds) {
+  // Load the round keys
+  __m128i k[15];
+  aes_niload(rk,k,rounds);
+  // Encrypt interleaved groups of blocks to hide the instruction latency
+  size_t i = 0;
+  for (; i+AES_LANES <= n; i += AES_LANES) {
+    __m128i s[AES_LANES];
+    for (size_t j = 0; j < AES_LANES; ++j)
+      s[j] = _mm_loadu_si128((const __m128i*)(pb+16*(i+j)));
+    for (size_t j = 0; j < AES_LANES; ++j)
+      s[j] = _mm_xor_si128(s[j],k[0]);
+    for (int r = 1; r < rounds; ++r)
+      for (size_t j = 0; j < AES_LANES; ++j)
+        s[j] = _mm_aesenc_si128(s[j],k[r]);
+    for (size_t j = 0; j < AES_LANES; ++j)
+      s[j] = _mm_aesenclast_si128(s[j],k[rounds]);
+    for (size_t j = 0; j < AES_LANES; ++j)
+      _mm_storeu_si128((__m128i*)(pb+16*(i+j)),s[j]);
+  }
+  // Encrypt the remaining blocks one by one
+  for (; i < n; ++i) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(pb+16*i));
+    s = _mm_xor_si128(s,k[0]);
+    for (int r = 1; r < rounds; ++r)
+      s = _mm_aesenc_si128(s,k[r]);
+    s = _mm_aesenclast_si128(s,k[rounds]);
+    _mm_storeu_si128((__m128i*)(pb+16*i),s);
+  }
+}
+
+/** Encrypts n consecutive 128-bit blocks with AES-NI instructions. */
+__attribute__((target("aes,ssse3")))
+static void aes_niblocks(const uint32_t rk[60], const int rounds,
+unsigned char* pb, const size_t n) {
+  // Run the code of the key size
+  AES_UNROLL(aes_nirounds,rounds,rk,pb,n);
+}
+
+/** Encrypts n consecutive 128-bit blocks with VAES instructions, for a
+ * constant number of rounds. */
+__attribute__((target("aes,ssse3,avx2,vaes"),always_inline))
+static inline void aes_vaesrounds(const uint32_t rk[60], unsigned char* pb,
+const size_t n, const int rounds) {
+  // Load the round keys in both lanes
+  __m128i k[15];
+  __m256i w[15];
+  aes_niload(rk,k,rounds);
+  for (int r = 0; r <= rounds; ++r)
+    w[r] = _mm256_broadcastsi128_si256(k[r]);
+  // Encrypt interleaved groups of block pairs to hide the instruction latency
+  size_t i = 0;
+  for (; i+AES_LANES <= n; i += AES_LANES) {
+    __m256i s[AES_LANES/2];
+    for (size_t j = 0; j < AES_LANES/2; ++j)
+      s[j] = _mm256_loadu_si256((const __m256i*)(pb+16*i+32*j));
+    for (size_t j = 0; j < AES_LANES/2; ++j)
+      s[j] = _mm256_xor_si256(s[j],w[0]);
+    for (int r = 1; r < rounds; ++r)
+      for (size_t j = 0; j < AES_LANES/2; ++j)
+        s[j] = _mm256_aesenc_epi128(s[j],w[r]);
+    for (size_t j = 0; j < AES_LANES/2; ++j)
+      s[j] = _mm256_aesenclast_epi128(s[j],w[rounds]);
+    for (size_t j = 0; j < AES_LANES/2; ++j)
+      _mm256_storeu_si256((__m256i*)(pb+16*i+32*j),s[j]);
+  }
+  // Encrypt the remaining pairs of blocks
+  for (; i+2 <= n; i += 2) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(pb+16*i));
+    s = _mm256_xor_si256(s,w[0]);
+    for (int r = 1; r < rounds; ++r)
+      s = _mm256_aesenc_epi128(s,w[r]);
+    s = _mm256_aesenclast_epi128(s,w[rounds]);
+    _mm256_storeu_si256((__m256i*)(pb+16*i),s);
+  }
+  // Encrypt the remaining block if there is one
+  if (i < n) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(pb+16*i));
+    s = _mm_xor_si128(s,k[0]);
+    for (int r = 1; r < rounds; ++r)
+      s = _mm_aesenc_si128(s,k[r]);
+    s = _mm_aesenclast_si128(s,k[rounds]);
+    _mm_storeu_si128((__m128i*)(pb+16*i),s);
+  }
+}
+
+/** Encrypts n consecutive 128-bit blocks with VAES instructions. */
+__attribute__((target("aes,ssse3,avx2,vaes")))
+static void aes_vaesblocks(const uint32_t rk[60], const int rounds,
+unsigned char* pb, const size_t n) {
+  // Run the code of the key size
+  AES_UNROLL(aes_vaesrounds,rounds,rk,pb,n);
+}
+
+/** Accumulates the words of the round key a and adds the assist word t, as a
+ * step of the AES-256 key expansion. */
+__attribute__((target("aes,ssse3")))
+static inline __m128i aes_nistep(__m128i a, const __m128i t) {
+  // Xor each word with all the previous ones
+  a = _mm_xor_si128(a,_mm_slli_si128(a,4));
+  a = _mm_xor_si128(a,_mm_slli_si128(a,4));
+  a = _mm_xor_si128(a,_mm_slli_si128(a,4));
+  return _mm_xor_si128(a,t);
+}
+
+/** Expands the keys of the n messages into the AES-NI round keys k, all of
+ * them at once so that their instructions overlap. */
+__attribute__((target("aes,ssse3")))
+static void aes_niexpand(const CrypMsg* msgs, __m128i k[][15],
+const size_t n) {
+  // The key itself gives the first two round keys
+  for (size_t j = 0; j < n; ++j) {
+    k[j][0] = _mm_loadu_si128((const __m128i*)msgs[j].key);
+    k[j][1] = _mm_loadu_si128((const __m128i*)(msgs[j].key+16));
+  }
+  // Derive the rest of the round keys of every schedule
+  AES_NIEVEN(k,n,2,0x01); AES_NIODD(k,n,3);
+  AES_NIEVEN(k,n,4,0x02); AES_NIODD(k,n,5);
+  AES_NIEVEN(k,n,6,0x04); AES_NIODD(k,n,7);
+  AES_NIEVEN(k,n,8,0x08); AES_NIODD(k,n,9);
+  AES_NIEVEN(k,n,10,0x10); AES_NIODD(k,n,11);
+  AES_NIEVEN(k,n,12,0x20); AES_NIODD(k,n,13);
+  AES_NIEVEN(k,n,14,0x40);
+}
+
+/** Transforms up to AES_LANES messages with AES-NI instructions. The keys
+ * are expanded together and the counter blocks of consecutive messages fill
+ * the interleaved lanes, so short messages keep the pipeline busy. */
+__attribute__((target("aes,ssse3")))
+static void aes_nibatch(CrypMsg* msgs, const size_t n) {
+  // Expand all the keys at once
+  __m128i k[AES_LANES][15];
+  aes_niexpand(msgs,k,n);
+  // Encrypt the counter blocks of every message AES_LANES at a time
+  size_t m = 0;
+  unsigned long long b = 0;
+  while (m < n) {
+    __m128i s[AES_LANES];
+    const __m128i* w[AES_LANES];
+    unsigned char* p[AES_LANES];
+    size_t len[AES_LANES];
+    // Take the next block of each lane, moving on when a message runs out
+    for (size_t j = 0; j < AES_LANES; ++j) {
+      while (m < n && 16*b >= msgs[m].data.len)
+        ++m, b = 0;
+      w[j] = k[(m < n) ? m : 0], p[j] = NULL, len[j] = 0;
+      s[j] = _mm_setzero_si128();
+      if (m < n) {
+        CrypText* d = &msgs[m].data;
+        s[j] = _mm_set_epi64x((long long)__builtin_bswap64(b),
+        (long long)__builtin_bswap64(d->nonce));
+        p[j] = d->text+16*b, len[j] = MIN(16,d->len-16*b), ++b;
+      }
+    }
+    // Encrypt the lanes, each one with the round keys of its message
+    for (size_t j = 0; j < AES_LANES; ++j)
+      s[j] = _mm_xor_si128(s[j],w[j][0]);
+    for (int r = 1; r < 14; ++r)
+      for (size_t j = 0; j < AES_LANES; ++j)
+        s[j] = _mm_aesenc_si128(s[j],w[j][r]);
+    for (size_t j = 0; j < AES_LANES; ++j)
+      s[j] = _mm_aesenclast_si128(s[j],w[j][14]);
+    // Xor the keystream with the messages
+    for (size_t j = 0; j < AES_LANES; ++j) {
+      if (len[j] == 16)
+        _mm_storeu_si128((__m128i*)p[j],_mm_xor_si128(s[j],
+        _mm_loadu_si128((const __m128i*)p[j])));
+      else if (len[j]) {
+        unsigned char ks[16];
+        _mm_storeu_si128((__m128i*)ks,s[j]);
+        aes_xor(p[j],ks,len[j]);
+      }
+    }
+  }
+}
+
+/** Adds the carry-less product of a and b to the 256-bit value lo, hi. */
+__attribute__((target("pclmul,ssse3")))
+static inline void aes_clmul(const __m128i a, const __m128i b, __m128i* lo,
+__m128i* hi) {
+  // Multiply the halves, adding the middle terms to both sides
+  __m128i m = _mm_xor_si128(_mm_clmulepi64_si128(a,b,0x10),
+  _mm_clmulepi64_si128(a,b,0x01));
+  *lo = _mm_xor_si128(*lo,_mm_xor_si128(_mm_clmulepi64_si128(a,b,0x00),
+  _mm_slli_si128(m,8)));
+  *hi = _mm_xor_si128(*hi,_mm_xor_si128(_mm_clmulepi64_si128(a,b,0x11),
+  _mm_srli_si128(m,8)));
+}
+
+/** Reduces the 256-bit product lo, hi of byte-reflected GHASH values. */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i aes_clreduce(__m128i lo, __m128i hi) {
+  // Shift the product one bit left, since its operands are bit-reflected
+  __m128i a = _mm_srli_epi32(lo,31), b = _mm_srli_epi32(hi,31);
+  __m128i c = _mm_srli_si128(a,12);
+  lo = _mm_or_si128(_mm_slli_epi32(lo,1),_mm_slli_si128(a,4));
+  hi = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(hi,1),_mm_slli_si128(b,4)),c);
+  // Reduce modulo the polynomial of the field in two phases
+  a = _mm_xor_si128(_mm_slli_epi32(lo,31),_mm_slli_epi32(lo,30));
+  a = _mm_xor_si128(a,_mm_slli_epi32(lo,25));
+  b = _mm_srli_si128(a,4), lo = _mm_xor_si128(lo,_mm_slli_si128(a,12));
+  a = _mm_xor_si128(_mm_srli_epi32(lo,1),_mm_srli_epi32(lo,2));
+  a = _mm_xor_si128(_mm_xor_si128(a,_mm_srli_epi32(lo,7)),b);
+  return _mm_xor_si128(hi,_mm_xor_si128(lo,a));
+}
+
+/** Computes the byte-reflected powers of the hash key h from 1 to 4. */
+__attribute__((target("pclmul,ssse3")))
+static void aes_clpowers(const unsigned char h[16], unsigned char hp[4][16]) {
+  // Reflect the key and multiply it by itself repeatedly
+  const __m128i swap = _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+  __m128i k = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)h),swap);
+  __m128i p = k;
+  for (int i = 0; i < 4; ++i) {
+    _mm_storeu_si128((__m128i*)hp[i],p);
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    aes_clmul(p,k,&lo,&hi), p = aes_clreduce(lo,hi);
+  }
+}
+
+/** Absorbs n blocks of data into the GHASH value x with carry-less products,
+ * aggregating four blocks per reduction. */
+__attribute__((target("pclmul,ssse3")))
+static void aes_clhash(const unsigned char hp[4][16], unsigned char x[16],
+const unsigned char* data, const size_t n) {
+  // Load the value and the powers of the hash key
+  const __m128i swap = _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+  __m128i h[4], v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)x),swap);
+  for (int i = 0; i < 4; ++i)
+    h[i] = _mm_loadu_si128((const __m128i*)hp[i]);
+  // Multiply groups of four blocks by decreasing powers of the key
+  size_t i = 0;
+  for (; i+4 <= n; i += 4) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    for (int j = 0; j < 4; ++j) {
+      __m128i c = _mm_loadu_si128((const __m128i*)(data+16*(i+(size_t)j)));
+      c = _mm_shuffle_epi8(c,swap);
+      aes_clmul((j) ? c : _mm_xor_si128(v,c),h[3-j],&lo,&hi);
+    }
+    v = aes_clreduce(lo,hi);
+  }
+  // Multiply the remaining blocks one by one
+  for (; i < n; ++i) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    __m128i c = _mm_loadu_si128((const __m128i*)(data+16*i));
+    aes_clmul(_mm_xor_si128(v,_mm_shuffle_epi8(c,swap)),h[0],&lo,&hi);
+    v = aes_clreduce(lo,hi);
+  }
+  _mm_storeu_si128((__m128i*)x,_mm_shuffle_epi8(v,swap));
+}
+
+/** Xors the text with the stream in 128-bit registers, with aligned
+ * accesses if both share their alignment. Returns the bytes xored. */
+__attribute__((target("sse2")))
+static size_t aes_xorsse2(unsigned char* text, const unsigned char* stream,
+const size_t len) {
+  // Use the aligned operations only if both are aligned
+  size_t i = 0;
+  if (!(((uintptr_t)text|(uintptr_t)stream)&15))
+    AES_XORLOOP(text,stream,len,i,16,__m128i,_mm_load_si128,_mm_store_si128,
+    _mm_xor_si128);
+  else
+    AES_XORLOOP(text,stream,len,i,16,__m128i,_mm_loadu_si128,
+    _mm_storeu_si128,_mm_xor_si128);
+  return i;
+}
+
+/** Xors the text with the stream in 256-bit registers, with aligned
+ * accesses if both share their alignment. Returns the bytes xored. */
+__attribute__((target("avx2")))
+static size_t aes_xoravx2(unsigned char* text, const unsigned char* stream,
+const size_t len) {
+  // Use the aligned operations only if both are aligned
+  size_t i = 0;
+  if (!(((uintptr_t)text|(uintptr_t)stream)&31))
+    AES_XORLOOP(text,stream,len,i,32,__m256i,_mm256_load_si256,
+    _mm256_store_si256,_mm256_xor_si256);
+  else
+    AES_XORLOOP(text,stream,len,i,32,__m256i,_mm256_loadu_si256,
+    _mm256_storeu_si256,_mm256_xor_si256);
+  return i;
+}
+
+/** Xors the text with the stream in 512-bit registers, with aligned
+ * accesses if both share their alignment. Returns the bytes xored. */
+__attribute__((target("avx512f")))
+static size_t aes_xoravx512(unsigned char* text, const unsigned char* stream,
+const size_t len) {
+  // Use the aligned operations only if both are aligned
+  size_t i = 0;
+  if (!(((uintptr_t)text|(uintptr_t)stream)&63))
+    AES_XORLOOP(text,stream,len,i,64,__m512i,_mm512_load_si512,
+    _mm512_store_si512,_mm512_xor_si512);
+  else
+    AES_XORLOOP(text,stream,len,i,64,__m512i,_mm512_loadu_si512,
+    _mm512_storeu_si512,_mm512_xor_si512);
+  return i;
+}
+
+/** Chooses the bytes of the widest registers that the processor supports to
+ * xor a stream, used as a once routine. */
+static void aes_xorwidth(void) {
+  // Check the vector extensions from the widest one
+  __builtin_cpu_init();
+  int width = 8;
+  if (__builtin_cpu_supports("avx512f"))
+    width = 64;
+  else if (__builtin_cpu_supports("avx2"))
+    width = 32;
+  else if (__builtin_cpu_supports("sse2"))
+    width = 16;
+  // Publish the choice
+  aesxor = width;
+}
+
+#endif // AES_X86
+
+/** Multiplies the GHASH value x by the hash key of gcm with its tables. */
+static void aes_tablemult(AesGcm gcm, unsigned char x[16]) {
+  // Multiply by each nibble from the last one, reducing what is shifted out
+  uint64_t zh = gcm->hh[x[15]&0xf], zl = gcm->hl[x[15]&0xf];
+  for (int i = 15; i >= 0; --i)
+    for (int half = (i == 15); half < 2; ++half) {
+      unsigned nib = (half) ? (unsigned)(x[i]>>4) : (unsigned)(x[i]&0xf);
+      unsigned rem = (unsigned)(zl&0xf);
+      zl = zh<<60|zl>>4, zh = zh>>4^(uint64_t)ghr[rem]<<48;
+      zh ^= gcm->hh[nib], zl ^= gcm->hl[nib];
+    }
+  // Store the product
+  for (int b = 0; b < 8; ++b) {
+    x[b] = (unsigned char)(zh>>(56-8*b));
+    x[8+b] = (unsigned char)(zl>>(56-8*b));
+  }
+}
+
+/** Absorbs n blocks of data into the GHASH value x. */
+static void aes_ghashblocks(AesGcm gcm, unsigned char x[16],
+const unsigned char* data, const size_t n) {
+#if AES_X86
+  // Use carry-less products if they are available
+  if (gcm->clmul) {
+    aes_clhash((const unsigned char (*)[16])gcm->hp,x,data,n);
+    return;
+  }
+#endif // AES_X86
+  // Add and multiply each block otherwise
+  for (size_t i = 0; i < n; ++i)
+    aes_xor(x,data+16*i,16), aes_tablemult(gcm,x);
+}
+
+/** Completes the GHASH value x with the bit lengths of the additional data
+ * and the text, and encrypts it into the tag of the message. */
+static void aes_gcmfinal(AesGcm gcm, unsigned char x[16],
+const unsigned long long nonce, const uint32_t id, const size_t alen,
+const size_t len) {
+  // Absorb the lengths
+  unsigned char block[16];
+  for (int b = 0; b < 8; ++b) {
+    block[b] = (unsigned char)((unsigned long long)alen*8>>(56-8*b));
+    block[8+b] = (unsigned char)((unsigned long long)len*8>>(56-8*b));
+  }
+  aes_ghashblocks(gcm,x,block,1);
+  // Xor the hash with the first counter block
+  aes_ctr(&gcm->aes,nonce,((unsigned long long)id<<32)+1,x,16);
+}
+
+/** Transposes the 8x8 bit matrices formed by each byte of the eight slices,
+ * so that bit j of byte m of slice b is swapped with bit b of byte m of j. */
+__attribute__((always_inline))
+static inline void aes_ortho(AesSlice q[8]) {
+  // Swap single bits, then pairs of bits, then nibbles
+  for (int s = 1, i = 0; s < 8; s <<= 1, ++i) {
+    const uint64_t m = (i == 0) ? 0x5555555555555555 :
+    (i == 1) ? 0x3333333333333333 : 0x0f0f0f0f0f0f0f0f;
+    for (int a = 0; a < 8; ++a)
+      if (!(a&s)) {
+        AesSlice t = ((q[a]>>s)^q[a+s])&m;
+        q[a+s] ^= t, q[a] ^= t<<s;
+      }
+  }
+}
+
+/** Applies the substitution box to the bit planes q, using the circuit of
+ * Boyar and Peralta, which has no secret-dependent memory accesses. */
+__attribute__((always_inline))
+static inline void aes_slicesbox(AesSlice q[8]) {
+  // Top linear transformation
+  AesSlice x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+  AesSlice x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+  AesSlice y14 = x3^x5, y13 = x0^x6, y9 = x0^x3, y8 = x0^x5;
+  AesSlice t0 = x1^x2, y1 = t0^x7, y4 = y1^x3, y12 = y13^y14;
+  AesSlice y2 = y1^x0, y5 = y1^x6, y3 = y5^y8, t1 = x4^y12;
+  AesSlice y15 = t1^x5, y20 = t1^x1, y6 = y15^x7, y10 = y15^t0;
+  AesSlice y11 = y20^y9, y7 = x7^y11, y17 = y10^y11, y19 = y10^y8;
+  AesSlice y16 = t0^y11, y21 = y13^y16, y18 = x0^y16;
+  // Shared non-linear section
+  AesSlice t2 = y12&y15, t3 = y3&y6, t4 = t3^t2, t5 = y4&x7;
+  AesSlice t6 = t5^t2, t7 = y13&y16, t8 = y5&y1, t9 = t8^t7;
+  AesSlice t10 = y2&y7, t11 = t10^t7, t12 = y9&y11, t13 = y14&y17;
+  AesSlice t14 = t13^t12, t15 = y8&y10, t16 = t15^t12, t17 = t4^t14;
+  AesSlice t18 = t6^t16, t19 = t9^t14, t20 = t11^t16, t21 = t17^y20;
+  AesSlice t22 = t18^y19, t23 = t19^y21, t24 = t20^y18;
+  // Inversion in the composite field
+  AesSlice t25 = t21^t22, t26 = t21&t23, t27 = t24^t26, t28 = t25&t27;
+  AesSlice t29 = t28^t22, t30 = t23^t24, t31 = t22^t26, t32 = t31&t30;
+  AesSlice t33 = t32^t24, t34 = t23^t33, t35 = t27^t33, t36 = t24&t35;
+  AesSlice t37 = t36^t34, t38 = t27^t36, t39 = t29&t38, t40 = t25^t39;
+  AesSlice t41 = t40^t37, t42 = t29^t33, t43 = t29^t40, t44 = t33^t37;
+  AesSlice t45 = t42^t41;
+  AesSlice z0 = t44&y15, z1 = t37&y6, z2 = t33&x7, z3 = t43&y16;
+  AesSlice z4 = t40&y1, z5 = t29&y7, z6 = t42&y11, z7 = t45&y17;
+  AesSlice z8 = t41&y10, z9 = t44&y12, z10 = t37&y3, z11 = t33&y4;
+  AesSlice z12 = t43&y13, z13 = t40&y5, z14 = t29&y2, z15 = t42&y9;
+  AesSlice z16 = t45&y14, z17 = t41&y8;
+  // Bottom linear transformation
+  AesSlice t46 = z15^z16, t47 = z10^z11, t48 = z5^z13, t49 = z9^z10;
+  AesSlice t50 = z2^z12, t51 = z2^z5, t52 = z7^z8, t53 = z0^z3;
+  AesSlice t54 = z6^z7, t55 = z16^z17, t56 = z12^t48, t57 = t50^t53;
+  AesSlice t58 = z4^t46, t59 = z3^t54, t60 = t46^t57, t61 = z14^t57;
+  AesSlice t62 = t52^t58, t63 = t49^t58, t64 = z4^t59, t65 = t61^t62;
+  AesSlice t66 = z1^t63, t67 = t64^t65;
+  AesSlice s3 = t53^t66;
+  q[7] = t59^t63, q[6] = t64^~s3, q[5] = t55^~t67, q[4] = s3;
+  q[3] = t51^t66, q[2] = t47^t65, q[1] = t56^~t62, q[0] = t48^~t60;
+}
+
+/** Applies the row shift to the bit planes q. Within each plane, row r takes
+ * bits 16r to 16r+15 and column c of it takes 4 bits, one per block. */
+__attribute__((always_inline))
+static inline void aes_sliceshift(AesSlice q[8]) {
+  // Rotate rows 2 and 3 by two columns, and then rows 1 and 3 by one more
+  for (int b = 0; b < 8; ++b) {
+    AesSlice x = q[b];
+    x = (x&0x00000000ffffffff)|((x>>8)&0x00ff00ff00000000)|
+    ((x<<8)&0xff00ff0000000000);
+    q[b] = (x&0x0000ffff0000ffff)|((x>>4)&0x0fff00000fff0000)|
+    ((x<<12)&0xf0000000f0000000);
+  }
+}
+
+/** Applies the column mixing to the bit planes q. */
+__attribute__((always_inline))
+static inline void aes_slicemix(AesSlice q[8]) {
+  // Each row is combined with the following ones through 16-bit rotations
+  AesSlice r[8], t[8];
+  for (int b = 0; b < 8; ++b)
+    r[b] = (q[b]>>16)|(q[b]<<48), t[b] = q[b]^r[b];
+  // Multiply the sum of each row and the next by 2, which is a linear map
+  q[0] = t[7], q[1] = t[0]^t[7], q[2] = t[1], q[3] = t[2]^t[7];
+  q[4] = t[3]^t[7], q[5] = t[4], q[6] = t[5], q[7] = t[6];
+  for (int b = 0; b < 8; ++b)
+    q[b] ^= r[b]^(t[b]>>32)^(t[b]<<32);
+}
+
+/** Converts AES_SLICES consecutive blocks pb into bit planes q. */
+__attribute__((always_inline))
+static inline void aes_slicepack(AesSlice q[8], const unsigned char* pb) {
+  // Interleave the bytes of columns c and c+2 of block k of each lane, so
+  // that the transposition leaves them at bits 16*row+4*col+k of the planes
+  uint64_t w[8][AES_SLICES/4];
+  for (size_t l = 0; l < AES_SLICES/4; ++l)
+    for (int j = 0; j < 8; ++j) {
+      const unsigned char* c = pb+64*l+16*(j&3)+4*(j>>2);
+      uint64_t lo = 0, hi = 0;
+      for (int row = 3; row >= 0; --row)
+        lo = lo<<16|c[row], hi = hi<<16|c[8+row];
+      w[j][l] = lo|hi<<8;
+    }
+  memcpy(q,w,sizeof(w));
+  aes_ortho(q);
+}
+
+/** Converts the bit planes q into AES_SLICES consecutive blocks pb. */
+__attribute__((always_inline))
+static inline void aes_sliceunpack(unsigned char* pb, AesSlice q[8]) {
+  // Undo the transposition and the interleaving of the bytes
+  uint64_t w[8][AES_SLICES/4];
+  aes_ortho(q);
+  memcpy(w,q,sizeof(w));
+  for (size_t l = 0; l < AES_SLICES/4; ++l)
+    for (int j = 0; j < 8; ++j) {
+      unsigned char* c = pb+64*l+16*(j&3)+4*(j>>2);
+      for (int row = 0; row < 4; ++row)
+        c[row] = (unsigned char)(w[j][l]>>16*row);
+      for (int row = 0; row < 4; ++row)
+        c[8+row] = (unsigned char)(w[j][l]>>(16*row+8));
+    }
+}
+
+/** Encrypts n consecutive 128-bit blocks with bitsliced logic operations,
+ * AES_SLICES at a time, so that the time does not depend on the data. */
+__attribute__((always_inline))
+static inline void aes_slicebatch(const uint32_t rk[60], unsigned char* pb,
+const size_t n, const int rounds) {
+  // Convert each round key into bit planes, repeated for every block
+  AesSlice sk[15][8];
+  unsigned char kb[16*AES_SLICES];
+  for (int r = 0; r <= rounds; ++r)
+    for (int b = 0; b < 8; ++b) {
+      uint64_t plane = 0;
+      for (int i = 0; i < 16; ++i) {
+        uint64_t bit = rk[4*r+i/4]>>(24-8*(i&3)+b)&1;
+        plane |= (bit*0xf)<<(16*(i&3)+4*(i>>2));
+      }
+      for (size_t l = 0; l < AES_SLICES/4; ++l)
+        sk[r][b][l] = plane;
+    }
+  // Encrypt each group of blocks, completing the last one if necessary
+  for (size_t i = 0; i < n; i += AES_SLICES) {
+    unsigned char* p = pb+16*i;
+    if (n-i < AES_SLICES)
+      memcpy(kb,p,16*(n-i)), p = kb;
+    AesSlice q[8];
+    aes_slicepack(q,p);
+    for (int b = 0; b < 8; ++b)
+      q[b] ^= sk[0][b];
+    for (int r = 1; r <= rounds; ++r) {
+      aes_slicesbox(q), aes_sliceshift(q);
+      if (r != rounds)
+        aes_slicemix(q);
+      for (int b = 0; b < 8; ++b)
+        q[b] ^= sk[r][b];
+    }
+    aes_sliceunpack(p,q);
+    if (p == kb)
+      memcpy(pb+16*i,kb,16*(n-i));
+  }
+}
+
+#if AES_X86
+
+/** Encrypts n consecutive 128-bit blocks with bitsliced AVX2 operations. */
+__attribute__((target("avx2")))
+static void aes_slicewide(const uint32_t rk[60], const int rounds,
+unsigned char* pb, const size_t n) {
+  // Encrypt the blocks with 256-bit registers
+  AES_UNROLL(aes_slicebatch,rounds,rk,pb,n);
+}
+
+#endif // AES_X86
+
+/** Encrypts n consecutive 128-bit blocks with bitsliced operations on the
+ * baseline vector registers, which are SSE2 ones on x86-64. */
+static void aes_slicenarrow(const uint32_t rk[60], const int rounds,
+unsigned char* pb, const size_t n) {
+  // Encrypt the blocks with the default registers
+  AES_UNROLL(aes_slicebatch,rounds,rk,pb,n);
+}
+
+/** Encrypts n consecutive 128-bit blocks with the given implementation. */
+static void aes_encwith(const AesImpl impl, const uint32_t rk[60],
+const int rounds, unsigned char* pb, const size_t n) {
+  // Dispatch to the code of the implementation
+  switch (impl) {
+#if AES_X86
+    case AES_VECTOR:
+      aes_vaesblocks(rk,rounds,pb,n);
+      break;
+    case AES_HARDWARE:
+      aes_niblocks(rk,rounds,pb,n);
+      break;
+#endif // AES_X86
+    case AES_BITSLICE:
+#if AES_X86
+      if (__builtin_cpu_supports("avx2")) {
+        aes_slicewide(rk,rounds,pb,n);
+        break;
+      }
+#endif // AES_X86
+      aes_slicenarrow(rk,rounds,pb,n);
+      break;
+    default: {
+      size_t i = 0;
+      for (; i+2 <= n; i += 2)
+        aes_tablepair(rk,rounds,pb+16*i);
+      for (; i < n; ++i)
+        aes_tableblock(rk,rounds,pb+16*i);
+    }
+  }
+}
+
+/** Encrypts m consecutive 128-bit blocks side by side with lookup tables, for
+ * a constant number of blocks up to two and a constant number of rounds. */
+__attribute__((always_inline))
+static inline void aes_tablerounds(const uint32_t rk[60], unsigned char* pb,
+const int m, const int rounds) {
+  // Map byte array blocks to cipher states and add initial round key
+  uint32_t s[8], t[8];
+  for (int i = 0; i < 4*m; ++i) {
+    s[i] = ((uint32_t)pb[4*i]<<24)^((uint32_t)pb[4*i+1]<<16);
+    s[i] ^= ((uint32_t)pb[4*i+2]<<8)^((uint32_t)pb[4*i+3])^rk[i&3];
+  }
+  // Apply the inner rounds, whose number is odd for every key size
+  for (int r = 1; r < rounds; r += 2) {
+    for (int b = 0; b < 4*m; b += 4)
+      AES_ROUND(t+b,s+b,rk+4*r);
+    if (r != rounds-1)
+      for (int b = 0; b < 4*m; b += 4)
+        AES_ROUND(s+b,t+b,rk+4*r+4);
+  }
+  // Apply last round and map cipher states to byte array blocks
+  for (int i = 0; i < 4*m; ++i) {
+    int b = i&~3, c = i&3;
+    uint32_t v = te4[t[b+c]>>24]&0xff000000;
+    v ^= te4[t[b+((c+1)&3)]>>16&0xff]&0xff0000;
+    v ^= te4[t[b+((c+2)&3)]>>8&0xff]&0xff00;
+    v ^= (te4[t[b+((c+3)&3)]&0xff]&0xff)^rk[4*rounds+c];
+    pb[4*i] = (unsigned char)(v>>24), pb[4*i+1] = (unsigned char)(v>>16);
+    pb[4*i+2] = (unsigned char)(v>>8), pb[4*i+3] = (unsigned char)v;
+  }
+}
+
+/** Transforms the given text range, used as a thread routine. */
+static void* aes_worker(void* arg) {
+  // Xor the range with its keystream
+  AesRange* range = arg;
+  aes_ctr(range->aes,range->nonce,range->count,range->text,range->len);
+  // Return nothing
+  return NULL;
+}
+
+/** Chooses the fastest implementation that the processor supports, used as
+ * a once routine. */
+static void aes_choose(void) {
+  // Check the implementations from the fastest one
+  int impl = AES_TABLE;
+  if (aes_supports(AES_VECTOR))
+    impl = AES_VECTOR;
+  else if (aes_supports(AES_HARDWARE))
+    impl = AES_HARDWARE;
+#if AES_X86
+  // Bitsliced operations only beat the tables with 256-bit registers
+  else if (__builtin_cpu_supports("avx2"))
+    impl = AES_BITSLICE;
+#endif // AES_X86
+  // Publish the choice
+  aesimpl = impl;
+}
+
+//_____________________________________________________________________________
+
 // ------ FUNCTIONS ------ //
 
 void aes_transform(CrypText* data, const unsigned char key[32]) {
-  // Expand the key
-  uint32_t rk[60];
-  aes_setenc(rk,key);
-  // Initialize the IV with the nonce and the counter as zero
-  unsigned char iv[16], block[16];
-  for (int i = 0; i < 8; ++i)
-    iv[i] = (unsigned char)(data->nonce>>(56-8*i)), iv[i+8] = '\0';
-  // Encrypt each 128-bit nonce-counter pair and xor it with the text
-  bool finish = data->len == 0;
-  for (size_t i = 0; !finish; i += 16) {
-    // Initialize the block
-    for (int j = 0; j < 16; ++j)
-      block[j] = iv[j];
-    // Encrypt the block
-    aes_encblock(rk,block);
-    // Xor the block with the corresponding text stream
-    for (size_t j = i; !finish && j-i < 16; ++j)
-      data->text[j] ^= block[j-i], finish = j == data->len-1;
-    // Increase the counter, or use the next nonce if the counter is too big
-    bool carry = true;
-    for (int j = 15; carry && j >= 0; --j)
-      carry = ++iv[j] == 0;
+  // Xor the text with the keystream in this thread
+  struct _Aes aes;
+  aes_init(&aes,key,AES_256);
+  aes_counter(&aes,data,0,1);
+}
+
+void aes_parallel(CrypText* data, const unsigned char key[32],
+const unsigned threads) {
+  // Transform the text from the first block of the keystream
+  aes_stream(data,key,0,threads);
+}
+
+void aes_stream(CrypText* data, const unsigned char key[32],
+const unsigned long long block, const unsigned threads) {
+  // Xor the text with the keystream, starting at the given block
+  struct _Aes aes;
+  aes_init(&aes,key,AES_256);
+  aes_split(&aes,data->nonce,block,data->text,data->len,threads);
+}
+
+void aes_range(CrypText* data, const unsigned char key[32],
+const unsigned long long offset, const unsigned threads) {
+  // Xor the text with the keystream, starting at the given offset
+  struct _Aes aes;
+  aes_init(&aes,key,AES_256);
+  aes_counter(&aes,data,offset,threads);
+}
+
+Aes aes_create(const unsigned char* key, const AesSize size) {
+  // Allocate the context and expand the key into it
+  Aes aes = MALLOC(sizeof(struct _Aes));
+  aes_init(aes,key,size);
+  // Return the new context
+  return aes;
+}
+
+void aes_encrypt(Aes aes, unsigned char* pb, const size_t n) {
+  // Encrypt the blocks with the implementation of the context
+  aes_encwith(aes->impl,aes->rk,aes->rounds,pb,n);
+}
+
+void aes_counter(Aes aes, CrypText* data, const unsigned long long offset,
+const unsigned threads) {
+  // Xor the text with the keystream, starting at the given offset
+  aes_seek(aes,data->nonce,offset,data->text,data->len,threads);
+}
+
+void aes_batch(CrypMsg* msgs, const size_t n) {
+  // Transform the messages in groups that fill the lanes of the hardware
+  AesImpl impl = aes_impl();
+  for (size_t i = 0; i < n; i += AES_LANES) {
+    size_t m = MIN(AES_LANES,n-i);
+#if AES_X86
+    if (impl == AES_HARDWARE || impl == AES_VECTOR) {
+      aes_nibatch(msgs+i,m);
+      continue;
+    }
+#endif // AES_X86
+    // Expand the keys of the group first and then transform each message
+    struct _Aes aes[AES_LANES];
+    for (size_t j = 0; j < m; ++j)
+      aes_init(aes+j,msgs[i+j].key,AES_256);
+    for (size_t j = 0; j < m; ++j) {
+      CrypText* d = &msgs[i+j].data;
+      aes_ctr(aes+j,d->nonce,0,d->text,d->len);
+    }
+  }
+}
+
+void aes_delete(Aes aes) {
+  // Wipe the round keys before freeing the context
+  volatile uint32_t* rk = aes->rk;
+  for (int i = 0; i < 60; ++i)
+    rk[i] = 0;
+  free(aes);
+}
+
+AesGcm aes_gcmcreate(const unsigned char* key, const AesSize size) {
+  // Allocate the context and derive everything from the key into it
+  AesGcm gcm = MALLOC(sizeof(struct _AesGcm));
+  aes_gcminit(gcm,key,size);
+  // Return the new context
+  return gcm;
+}
+
+void aes_gcmseal(AesGcm gcm, CrypText* data, const uint32_t id,
+const unsigned char* aad, const size_t alen, unsigned char tag[16]) {
+  // Refuse texts whose counter would run into the next IV
+  if (data->len > AES_GCMMAX)
+    FATAL("Text too long for AES-GCM.\n");
+  // Hash the additional data
+  unsigned char x[16] = {0};
+  unsigned long long count = ((unsigned long long)id<<32)+2;
+  aes_ghash(gcm,x,aad,alen);
+  // Encrypt and hash each piece of the text while it is in cache
+  for (size_t i = 0; i < data->len; i += 16*AES_BATCH, count += AES_BATCH) {
+    size_t n = MIN(16*AES_BATCH,data->len-i);
+    aes_ctr(&gcm->aes,data->nonce,count,data->text+i,n);
+    aes_ghash(gcm,x,data->text+i,n);
+  }
+  // Produce the tag
+  aes_gcmfinal(gcm,x,data->nonce,id,alen,data->len);
+  memcpy(tag,x,16);
+}
+
+bool aes_gcmopen(AesGcm gcm, CrypText* data, const uint32_t id,
+const unsigned char* aad, const size_t alen, const unsigned char tag[16]) {
+  // Refuse texts whose counter would run into the next IV
+  if (data->len > AES_GCMMAX)
+    return false;
+  // Hash the additional data
+  unsigned char x[16] = {0};
+  unsigned long long count = ((unsigned long long)id<<32)+2;
+  aes_ghash(gcm,x,aad,alen);
+  // Hash and decrypt each piece of the text while it is in cache
+  for (size_t i = 0; i < data->len; i += 16*AES_BATCH, count += AES_BATCH) {
+    size_t n = MIN(16*AES_BATCH,data->len-i);
+    aes_ghash(gcm,x,data->text+i,n);
+    aes_ctr(&gcm->aes,data->nonce,count,data->text+i,n);
   }
+  // Compare the tags without stopping at the first difference
+  aes_gcmfinal(gcm,x,data->nonce,id,alen,data->len);
+  unsigned char diff = 0;
+  for (int b = 0; b < 16; ++b)
+    diff |= x[b]^tag[b];
+  // Return whether they match
+  return !diff;
+}
+
+void aes_gcmdelete(AesGcm gcm) {
+  // Wipe the keys before freeing the context
+  volatile unsigned char* bytes = (volatile unsigned char*)gcm;
+  for (size_t i = 0; i < sizeof(struct _AesGcm); ++i)
+    bytes[i] = 0;
+  free(gcm);
+}
+
+AesImpl aes_impl(void) {
+  // Choose the fastest supported implementation once
+  pthread_once(&aesimplonce,aes_choose);
+  // Return the chosen implementation
+  return (AesImpl)aesimpl;
+}
+
+bool aes_select(const AesImpl impl) {
+  // Choose the implementation only if the processor supports it, after the
+  // default one so that it is not overwritten
+  pthread_once(&aesimplonce,aes_choose);
+  bool supported = aes_supports(impl);
+  if (supported)
+    aesimpl = (int)impl;
+  // Return whether the implementation was chosen
+  return supported;
 }
 
 //_____________________________________________________________________________
 
 // ------ AUXILIARIES ------ //
 
-void aes_setenc(uint32_t rk[60], const unsigned char key[32]) {
-  // Initialize up to the eighth expanded key cells
-  for (int i = 0; i < 8; ++i) {
+void aes_init(Aes aes, const unsigned char* key, const AesSize size) {
+  // Expand the key and fix the rounds and the implementation
+  aes_setenc(aes->rk,key,size);
+  aes->rounds = AES_ROUNDS(size), aes->impl = aes_impl();
+}
+
+void aes_gcminit(AesGcm gcm, const unsigned char* key, const AesSize size) {
+  // Expand the key and derive the hash key from it
+  aes_init(&gcm->aes,key,size);
+  unsigned char h[16] = {0};
+  aes_encrypt(&gcm->aes,h,1);
+  // Fill the tables with the multiples of the hash key by each nibble
+  uint64_t vh = 0, vl = 0;
+  for (int b = 0; b < 8; ++b)
+    vh = vh<<8|h[b], vl = vl<<8|h[8+b];
+  gcm->hh[0] = gcm->hl[0] = 0, gcm->hh[8] = vh, gcm->hl[8] = vl;
+  for (int i = 4; i > 0; i >>= 1) {
+    uint64_t t = (vl&1)*0xe1000000;
+    vl = vh<<63|vl>>1, vh = vh>>1^t<<32;
+    gcm->hh[i] = vh, gcm->hl[i] = vl;
+  }
+  for (int i = 2; i <= 8; i <<= 1)
+    for (int j = 1; j < i; ++j) {
+      gcm->hh[i+j] = gcm->hh[i]^gcm->hh[j];
+      gcm->hl[i+j] = gcm->hl[i]^gcm->hl[j];
+    }
+  // Use carry-less products unless the lookup tables were chosen
+  gcm->clmul = false;
+#if AES_X86
+  __builtin_cpu_init();
+  gcm->clmul = gcm->aes.impl != AES_TABLE;
+  gcm->clmul = gcm->clmul && __builtin_cpu_supports("pclmul");
+  gcm->clmul = gcm->clmul && __builtin_cpu_supports("ssse3");
+  if (gcm->clmul)
+    aes_clpowers(h,gcm->hp);
+#endif // AES_X86
+}
+
+void aes_ghash(AesGcm gcm, unsigned char x[16], const unsigned char* data,
+const size_t len) {
+  // Absorb the whole blocks
+  size_t full = len/16;
+  aes_ghashblocks(gcm,x,data,full);
+  // Absorb the last partial block padded with zeros
+  if (16*full < len) {
+    unsigned char last[16] = {0};
+    memcpy(last,data+16*full,len-16*full);
+    aes_ghashblocks(gcm,x,last,1);
+  }
+}
+
+void aes_setenc(uint32_t rk[60], const unsigned char* key,
+const AesSize size) {
+  // Initialize the expanded key cells that hold the key itself
+  int nk = (int)size/4, words = 4*AES_ROUNDS(size)+4;
+  for (int i = 0; i < nk; ++i) {
     rk[i] = ((uint32_t)key[4*i]<<24)^((uint32_t)key[4*i+1]<<16);
     rk[i] ^= ((uint32_t)key[4*i+2]<<8)^((uint32_t)key[4*i+3]);
   }
-  // Initialize the rest of the key cells
-  int j = 0;
-  while (j != -1) {
-    uint32_t t = rk[j+7];
-    rk[j+8] = rk[j]^(te4[t>>16&0xff]&0xff000000)^(te4[t>>8&0xff]&0xff0000);
-    rk[j+8] ^= (te4[t&0xff]&0xff00)^(te4[t>>24]&0xff)^rcon[j/8];
-    rk[j+9] = rk[j+1]^rk[j+8];
-    rk[j+10] = rk[j+2]^rk[j+9];
-    rk[j+11] = rk[j+3]^rk[j+10];
-    if (j != 48) {
-      t = rk[j+11];
-      rk[j+12] = rk[j+4]^(te4[t>>24]&0xff000000)^(te4[t>>16&0xff]&0xff0000);
-      rk[j+12] ^= (te4[t>>8&0xff]&0xff00)^(te4[t&0xff]&0xff);
-      rk[j+13] = rk[j+5]^rk[j+12];
-      rk[j+14] = rk[j+6]^rk[j+13];
-      rk[j+15] = rk[j+7]^rk[j+14];
-      j += 8;
+  // Initialize the rest of the key cells, substituting the previous one at
+  // the start of each group and halfway through those of 256-bit keys
+  for (int i = nk; i < words; ++i) {
+    uint32_t t = rk[i-1];
+    if (i%nk == 0) {
+      t = (te4[t>>16&0xff]&0xff000000)^(te4[t>>8&0xff]&0xff0000)^
+      (te4[t&0xff]&0xff00)^(te4[t>>24]&0xff)^rcon[i/nk-1];
+    }
+    else if (nk > 6 && i%nk == 4) {
+      t = (te4[t>>24]&0xff000000)^(te4[t>>16&0xff]&0xff0000)^
+      (te4[t>>8&0xff]&0xff00)^(te4[t&0xff]&0xff);
     }
+    rk[i] = rk[i-nk]^t;
+  }
+}
+
+void aes_encblock(const uint32_t rk[60], const int rounds,
+unsigned char pb[16]) {
+  // Encrypt the block with the chosen implementation
+  if (aes_impl() == AES_TABLE)
+    aes_tableblock(rk,rounds,pb);
+  else
+    aes_encblocks(rk,rounds,pb,1);
+}
+
+void aes_encblocks(const uint32_t rk[60], const int rounds, unsigned char* pb,
+const size_t n) {
+  // Encrypt the blocks with the chosen implementation
+  aes_encwith(aes_impl(),rk,rounds,pb,n);
+}
+
+void aes_ctr(Aes aes, unsigned long long nonce,
+unsigned long long count, unsigned char* text, const size_t len) {
+  // Process the text in batches of keystream blocks
+  _Alignas(64) unsigned char ks[16*AES_BATCH];
+  for (size_t i = 0; i < len; i += 16*AES_BATCH) {
+    // Build the counter blocks, carrying into the nonce if the counter wraps
+    size_t n = (len-i < 16*AES_BATCH) ? (len-i+15)/16 : AES_BATCH;
+    for (size_t j = 0; j < n; ++j) {
+      for (int b = 0; b < 8; ++b)
+        ks[16*j+(size_t)b] = (unsigned char)(nonce>>(56-8*b));
+      for (int b = 0; b < 8; ++b)
+        ks[16*j+8+(size_t)b] = (unsigned char)(count>>(56-8*b));
+      if (++count == 0)
+        ++nonce;
+    }
+    // Encrypt all the counter blocks at once and xor them with the text
+    aes_encrypt(aes,ks,n);
+    aes_xor(text+i,ks,(len-i < 16*n) ? len-i : 16*n);
+  }
+}
+
+void aes_split(Aes aes, const unsigned long long nonce,
+const unsigned long long count, unsigned char* text, const size_t len,
+const unsigned threads) {
+  // Avoid threads that would not have enough work to pay for themselves
+  size_t n = (threads) ? threads : aes_cores();
+  size_t most = (len+AES_MINSPLIT-1)/AES_MINSPLIT;
+  if (n > most)
+    n = most;
+  if (n <= 1) {
+    aes_ctr(aes,nonce,count,text,len);
+    return;
+  }
+  // Split the text into block-aligned ranges of similar length
+  AesRange* ranges = MALLOC(sizeof(AesRange)*n);
+  pthread_t* ids = MALLOC(sizeof(pthread_t)*n);
+  bool* started = MALLOC(sizeof(bool)*n);
+  size_t blocks = (len+15)/16, each = blocks/n, extra = blocks%n;
+  for (size_t i = 0, first = 0; i < n; ++i) {
+    size_t size = each+(i < extra);
+    // Carry into the nonce if the counter of the range wraps
+    ranges[i].count = count+first, ranges[i].nonce = nonce;
+    if (ranges[i].count < count)
+      ++ranges[i].nonce;
+    ranges[i].aes = aes, ranges[i].text = text+16*first;
+    ranges[i].len = (i+1 < n) ? 16*size : len-16*first;
+    first += size;
+  }
+  // Transform the first range in this thread and the rest in new ones
+  for (size_t i = 1; i < n; ++i)
+    started[i] = !pthread_create(ids+i,NULL,aes_worker,ranges+i);
+  aes_worker(ranges);
+  // Wait for the threads, transforming here the ranges that did not start
+  for (size_t i = 1; i < n; ++i) {
+    if (started[i])
+      pthread_join(ids[i],NULL);
     else
-      j = -1;
-  }
-}
-
-void aes_encblock(const uint32_t rk[60], unsigned char pb[16]) {
-  // Map byte array block to cipher state and add initial round key
-  uint32_t s0 = ((uint32_t)pb[0]<<24)^((uint32_t)pb[1]<<16);
-  s0 ^= ((uint32_t)pb[2]<<8)^((uint32_t)pb[3])^rk[0];
-  uint32_t s1 = ((uint32_t)pb[4]<<24)^((uint32_t)pb[5]<<16);
-  s1 ^= ((uint32_t)pb[6]<<8)^((uint32_t)pb[7])^rk[1];
-  uint32_t s2 = ((uint32_t)pb[8]<<24)^((uint32_t)pb[9]<<16);
-  s2 ^= ((uint32_t)pb[10]<<8)^((uint32_t)pb[11])^rk[2];
-  uint32_t s3 = ((uint32_t)pb[12]<<24)^((uint32_t)pb[13]<<16);
-  s3 ^= ((uint32_t)pb[14]<<8)^((uint32_t)pb[15])^rk[3];
-  uint32_t t0, t1, t2, t3;
-  // Round 1
-  t0 = te0[s0>>24]^te1[s1>>16&0xff]^te2[s2>>8&0xff]^te3[s3&0xff]^rk[4];
-  t1 = te0[s1>>24]^te1[s2>>16&0xff]^te2[s3>>8&0xff]^te3[s0&0xff]^rk[5];
-  t2 = te0[s2>>24]^te1[s3>>16&0xff]^te2[s0>>8&0xff]^te3[s1&0xff]^rk[6];
-  t3 = te0[s3>>24]^te1[s0>>16&0xff]^te2[s1>>8&0xff]^te3[s2&0xff]^rk[7];
-  //Round 2
-  s0 = te0[t0>>24]^te1[t1>>16&0xff]^te2[t2>>8&0xff]^te3[t3&0xff]^rk[8];
-  s1 = te0[t1>>24]^te1[t2>>16&0xff]^te2[t3>>8&0xff]^te3[t0&0xff]^rk[9];
-  s2 = te0[t2>>24]^te1[t3>>16&0xff]^te2[t0>>8&0xff]^te3[t1&0xff]^rk[10];
-  s3 = te0[t3>>24]^te1[t0>>16&0xff]^te2[t1>>8&0xff]^te3[t2&0xff]^rk[11];
-  //Round 3
-  t0 = te0[s0>>24]^te1[s1>>16&0xff]^te2[s2>>8&0xff]^te3[s3&0xff]^rk[12];
-  t1 = te0[s1>>24]^te1[s2>>16&0xff]^te2[s3>>8&0xff]^te3[s0&0xff]^rk[13];
-  t2 = te0[s2>>24]^te1[s3>>16&0xff]^te2[s0>>8&0xff]^te3[s1&0xff]^rk[14];
-  t3 = te0[s3>>24]^te1[s0>>16&0xff]^te2[s1>>8&0xff]^te3[s2&0xff]^rk[15];
-  //Round 4
-  s0 = te0[t0>>24]^te1[t1>>16&0xff]^te2[t2>>8&0xff]^te3[t3&0xff]^rk[16];
-  s1 = te0[t1>>24]^te1[t2>>16&0xff]^te2[t3>>8&0xff]^te3[t0&0xff]^rk[17];
-  s2 = te0[t2>>24]^te1[t3>>16&0xff]^te2[t0>>8&0xff]^te3[t1&0xff]^rk[18];
-  s3 = te0[t3>>24]^te1[t0>>16&0xff]^te2[t1>>8&0xff]^te3[t2&0xff]^rk[19];
-  //Round 5
-  t0 = te0[s0>>24]^te1[s1>>16&0xff]^te2[s2>>8&0xff]^te3[s3&0xff]^rk[20];
-  t1 = te0[s1>>24]^te1[s2>>16&0xff]^te2[s3>>8&0xff]^te3[s0&0xff]^rk[21];
-  t2 = te0[s2>>24]^te1[s3>>16&0xff]^te2[s0>>8&0xff]^te3[s1&0xff]^rk[22];
-  t3 = te0[s3>>24]^te1[s0>>16&0xff]^te2[s1>>8&0xff]^te3[s2&0xff]^rk[23];
-  //Round 6
-  s0 = te0[t0>>24]^te1[t1>>16&0xff]^te2[t2>>8&0xff]^te3[t3&0xff]^rk[24];
-  s1 = te0[t1>>24]^te1[t2>>16&0xff]^te2[t3>>8&0xff]^te3[t0&0xff]^rk[25];
-  s2 = te0[t2>>24]^te1[t3>>16&0xff]^te2[t0>>8&0xff]^te3[t1&0xff]^rk[26];
-  s3 = te0[t3>>24]^te1[t0>>16&0xff]^te2[t1>>8&0xff]^te3[t2&0xff]^rk[27];
-  //Round 7
-  t0 = te0[s0>>24]^te1[s1>>16&0xff]^te2[s2>>8&0xff]^te3[s3&0xff]^rk[28];
-  t1 = te0[s1>>24]^te1[s2>>16&0xff]^te2[s3>>8&0xff]^te3[s0&0xff]^rk[29];
-  t2 = te0[s2>>24]^te1[s3>>16&0xff]^te2[s0>>8&0xff]^te3[s1&0xff]^rk[30];
-  t3 = te0[s3>>24]^te1[s0>>16&0xff]^te2[s1>>8&0xff]^te3[s2&0xff]^rk[31];
-  //Round 8
-  s0 = te0[t0>>24]^te1[t1>>16&0xff]^te2[t2>>8&0xff]^te3[t3&0xff]^rk[32];
-  s1 = te0[t1>>24]^te1[t2>>16&0xff]^te2[t3>>8&0xff]^te3[t0&0xff]^rk[33];
-  s2 = te0[t2>>24]^te1[t3>>16&0xff]^te2[t0>>8&0xff]^te3[t1&0xff]^rk[34];
-  s3 = te0[t3>>24]^te1[t0>>16&0xff]^te2[t1>>8&0xff]^te3[t2&0xff]^rk[35];
-  //Round 9
-  t0 = te0[s0>>24]^te1[s1>>16&0xff]^te2[s2>>8&0xff]^te3[s3&0xff]^rk[36];
-  t1 = te0[s1>>24]^te1[s2>>16&0xff]^te2[s3>>8&0xff]^te3[s0&0xff]^rk[37];
-  t2 = te0[s2>>24]^te1[s3>>16&0xff]^te2[s0>>8&0xff]^te3[s1&0xff]^rk[38];
-  t3 = te0[s3>>24]^te1[s0>>16&0xff]^te2[s1>>8&0xff]^te3[s2&0xff]^rk[39];
-  //Round 10
-  s0 = te0[t0>>24]^te1[t1>>16&0xff]^te2[t2>>8&0xff]^te3[t3&0xff]^rk[40];
-  s1 = te0[t1>>24]^te1[t2>>16&0xff]^te2[t3>>8&0xff]^te3[t0&0xff]^rk[41];
-  s2 = te0[t2>>24]^te1[t3>>16&0xff]^te2[t0>>8&0xff]^te3[t1&0xff]^rk[42];
-  s3 = te0[t3>>24]^te1[t0>>16&0xff]^te2[t1>>8&0xff]^te3[t2&0xff]^rk[43];
-  //Round 11
-  t0 = te0[s0>>24]^te1[s1>>16&0xff]^te2[s2>>8&0xff]^te3[s3&0xff]^rk[44];
-  t1 = te0[s1>>24]^te1[s2>>16&0xff]^te2[s3>>8&0xff]^te3[s0&0xff]^rk[45];
-  t2 = te0[s2>>24]^te1[s3>>16&0xff]^te2[s0>>8&0xff]^te3[s1&0xff]^rk[46];
-  t3 = te0[s3>>24]^te1[s0>>16&0xff]^te2[s1>>8&0xff]^te3[s2&0xff]^rk[47];
-  //Round 12
-  s0 = te0[t0>>24]^te1[t1>>16&0xff]^te2[t2>>8&0xff]^te3[t3&0xff]^rk[48];
-  s1 = te0[t1>>24]^te1[t2>>16&0xff]^te2[t3>>8&0xff]^te3[t0&0xff]^rk[49];
-  s2 = te0[t2>>24]^te1[t3>>16&0xff]^te2[t0>>8&0xff]^te3[t1&0xff]^rk[50];
-  s3 = te0[t3>>24]^te1[t0>>16&0xff]^te2[t1>>8&0xff]^te3[t2&0xff]^rk[51];
-  //Round 13
-  t0 = te0[s0>>24]^te1[s1>>16&0xff]^te2[s2>>8&0xff]^te3[s3&0xff]^rk[52];
-  t1 = te0[s1>>24]^te1[s2>>16&0xff]^te2[s3>>8&0xff]^te3[s0&0xff]^rk[53];
-  t2 = te0[s2>>24]^te1[s3>>16&0xff]^te2[s0>>8&0xff]^te3[s1&0xff]^rk[54];
-  t3 = te0[s3>>24]^te1[s0>>16&0xff]^te2[s1>>8&0xff]^te3[s2&0xff]^rk[55];
-  // Apply last round and map cipher state to byte array block
-  s0 = (te4[t0>>24]&0xff000000)^(te4[t1>>16&0xff]&0xff0000);
-  s0 ^= (te4[t2>>8&0xff]&0xff00)^(te4[t3&0xff]&0xff)^rk[56];
-  pb[0] = (unsigned char)(s0>>24), pb[1] = (unsigned char)(s0>>16);
-  pb[2] = (unsigned char)(s0>>8), pb[3] = (unsigned char)s0;
-  s1 = (te4[t1>>24]&0xff000000)^(te4[t2>>16&0xff]&0xff0000);
-  s1 ^= (te4[t3>>8&0xff]&0xff00)^(te4[t0&0xff]&0xff)^rk[57];
-  pb[4] = (unsigned char)(s1>>24), pb[5] = (unsigned char)(s1>>16);
-  pb[6] = (unsigned char)(s1>>8), pb[7] = (unsigned char)s1;
-  s2 = (te4[t2>>24]&0xff000000)^(te4[t3>>16&0xff]&0xff0000);
-  s2 ^= (te4[t0>>8&0xff]&0xff00)^(te4[t1&0xff]&0xff)^rk[58];
-  pb[8] = (unsigned char)(s2>>24), pb[9] = (unsigned char)(s2>>16);
-  pb[10] = (unsigned char)(s2>>8), pb[11] = (unsigned char)s2;
-  s3 = (te4[t3>>24]&0xff000000)^(te4[t0>>16&0xff]&0xff0000);
-  s3 ^= (te4[t1>>8&0xff]&0xff00)^(te4[t2&0xff]&0xff)^rk[59];
-  pb[12] = (unsigned char)(s3>>24), pb[13] = (unsigned char)(s3>>16);
-  pb[14] = (unsigned char)(s3>>8), pb[15] = (unsigned char)s3;
+      aes_worker(ranges+i);
+  }
+  // Free extra memory
+  free(ranges), free(ids), free(started);
+}
+
+void aes_seek(Aes aes, const unsigned long long nonce,
+const unsigned long long offset, unsigned char* text, const size_t len,
+const unsigned threads) {
+  // Xor the end of the first block if the offset falls inside it
+  unsigned long long block = offset/16;
+  size_t skip = (size_t)(offset%16), head = 0;
+  if (skip && len) {
+    unsigned char ks[16] = {0};
+    aes_ctr(aes,nonce,block++,ks,16);
+    head = MIN(16-skip,len);
+    aes_xor(text,ks+skip,head);
+  }
+  // Xor the rest of the text from the next block boundary
+  aes_split(aes,nonce,block,text+head,len-head,threads);
+}
+
+void aes_xor(unsigned char* text, const unsigned char* stream,
+const size_t len) {
+  size_t i = 0;
+#if AES_X86
+  // Choose the widest registers once
+  pthread_once(&aesxoronce,aes_xorwidth);
+  size_t w = (size_t)aesxor;
+  // Xor bytes up to the alignment of the text, then whole registers
+  if (w > 8 && len >= 2*w) {
+    i = (size_t)(-(uintptr_t)text&(w-1));
+    for (size_t j = 0; j < i; ++j)
+      text[j] ^= stream[j];
+    if (w == 64)
+      i += aes_xoravx512(text+i,stream+i,len-i);
+    else if (w == 32)
+      i += aes_xoravx2(text+i,stream+i,len-i);
+    else
+      i += aes_xorsse2(text+i,stream+i,len-i);
+  }
+#endif // AES_X86
+  // Xor whole words
+  for (; i+8 <= len; i += 8) {
+    uint64_t a, b;
+    memcpy(&a,text+i,8), memcpy(&b,stream+i,8), a ^= b;
+    memcpy(text+i,&a,8);
+  }
+  // Xor the remaining bytes
+  for (; i < len; ++i)
+    text[i] ^= stream[i];
+}
+
+void aes_tableblock(const uint32_t rk[60], const int rounds,
+unsigned char pb[16]) {
+  // Run the code of the key size
+  AES_UNROLL(aes_tablerounds,rounds,rk,pb,1);
+}
+
+void aes_tablepair(const uint32_t rk[60], const int rounds,
+unsigned char pb[32]) {
+  // Run the code of the key size
+  AES_UNROLL(aes_tablerounds,rounds,rk,pb,2);
+}
+
+bool aes_supports(const AesImpl impl) {
+  // Lookup tables and bitsliced operations are always supported
+  bool supported = impl == AES_TABLE || impl == AES_BITSLICE;
+#if AES_X86
+  // Check the processor features needed by the hardware implementations
+  __builtin_cpu_init();
+  bool ni = __builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3");
+  if (impl == AES_HARDWARE)
+    supported = ni;
+  else if (impl == AES_VECTOR) {
+    supported = ni && __builtin_cpu_supports("avx2");
+    supported = supported && __builtin_cpu_supports("vaes");
+  }
+#endif // AES_X86
+  // Return whether the implementation is supported
+  return supported;
+}
+
+unsigned aes_cores(void) {
+  // Ask the system for the online processors, assuming one if unknown
+  long cores = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+  cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif // _SC_NPROCESSORS_ONLN
+  // Return the number of processors
+  return (cores > 0) ? (unsigned)cores : 1;
 }
 
 //_____________________________________________________________________________
@@ -0,0 +1,629 @@
+/// SOURCE - ARCHIVE
+/** Source file for a seekable format of encrypted files split in chunks. */
+#ifndef __ARCHIVE_C__
+#define __ARCHIVE_C__
+
+//_____________________________________________________________________________
+
+// ------ INCLUDES ------ //
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif // _POSIX_C_SOURCE
+
+#include "../../include/archive.h"
+#include <string.h>
+#include <pthread.h>
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+#endif // _WIN32
+
+//_____________________________________________________________________________
+
+// ------ TYPES ------ //
+
+/** Transformations of the chunks of an archive. */
+typedef enum _ArcMode {
+  ARC_XOR, ARC_SEAL, ARC_OPEN, ARC_INFLATE
+} /** Chunk transformation type alias. */ ArcMode;
+
+/** Chunks transformed by a single thread. */
+typedef struct _ArcTask {
+  Arc arc; // archive of the chunks
+  ArcChunk* chunks; // chunks of the task
+  size_t count; // number of chunks
+  unsigned long long first; // index of the first chunk
+  unsigned threads; // threads used by each unauthenticated chunk
+  ArcMode mode; // transformation of the chunks
+  bool valid; // whether every tag matched
+} /** Chunk task type alias. */ ArcTask;
+
+//_____________________________________________________________________________
+
+// ------ STATICS ------ //
+
+/** Stores the size of fp in size, moving its position to the end. */
+static bool arc_length(FILE* fp, unsigned long long* size) {
+  // Go to the end and get the position there
+#if defined(_WIN32)
+  long long end = (_fseeki64(fp,0,SEEK_END)) ? -1 : _ftelli64(fp);
+#else
+  off_t end = (fseeko(fp,0,SEEK_END)) ? -1 : ftello(fp);
+#endif // _WIN32
+  *size = (unsigned long long)end;
+  // Return whether it succeeded
+  return end >= 0;
+}
+
+/** Records a new chunk of len bytes, stored in size bytes, at the current
+ * position of arc. */
+static void arc_push(Arc arc, const size_t len, const size_t size) {
+  // Grow the offsets if they are full
+  if (arc->count == arc->cap) {
+    arc->cap <<= 1;
+    arc->offs = REALLOC(arc->offs,sizeof(unsigned long long)*arc->cap);
+  }
+  // Store the offset of the record and move past it
+  arc->offs[arc->count++] = arc->pos;
+  arc->pos += arc_record(&arc->head,size), arc->len += len;
+}
+
+/** Creates an archive on fp with the given header and cipher contexts and no
+ * chunks. */
+static Arc arc_init(FILE* fp, const ArcHead* head, const ArcKey key) {
+  // Allocate the archive with room for a few chunks
+  Arc arc = MALLOC(sizeof(struct _Arc));
+  arc->fp = fp, arc->head = *head, arc->key = key;
+  arc->cap = 16, arc->count = 0;
+  arc->offs = MALLOC(sizeof(unsigned long long)*arc->cap);
+  arc->len = 0, arc->pos = ARC_HEAD, arc->end = false;
+  // Return the new archive
+  return arc;
+}
+
+/** Xors the text with the keystream of the cipher of arc that starts at the
+ * given byte offset, splitting the work among the given number of threads, or
+ * among all processors if threads is 0. */
+static void arc_counter(Arc arc, CrypText* data,
+const unsigned long long offset, const unsigned threads) {
+  // Use the context of the cipher
+  if (arc->head.cipher == ARC_CHACHA)
+    chacha_counter(arc->key.chacha,data,offset,threads);
+  else
+    aes_counter(&arc->key.gcm->aes,data,offset,threads);
+}
+
+/** Returns the number of bytes of the chunk c as stored in arc. */
+static size_t arc_stored(Arc arc, const ArcChunk* c) {
+  // Only the chunks of compressed archives may differ from their plaintext
+  return (arc->head.flags&ARC_LZ) ? c->size : c->len;
+}
+
+/** Compresses the chunk c in place through work, which has room for a whole
+ * chunk, unless that does not make it shorter, and sets its length as
+ * stored. */
+static void arc_deflate(ArcChunk* c, unsigned char* work) {
+  // Keep the compressed bytes only if they save any room
+  size_t n = lz_compress(c->text,c->len,work,c->len-1);
+  if (n)
+    memcpy(c->text,work,n);
+  c->size = (n) ? n : c->len;
+}
+
+/** Decompresses the chunk c in place through work, which has room for a whole
+ * chunk, if it was compressed. Returns whether it is valid. */
+static bool arc_inflate(ArcChunk* c, unsigned char* work) {
+  // Leave the chunks stored as they are untouched
+  if (c->size == c->len)
+    return true;
+  if (c->size > c->len || !lz_decompress(c->text,c->size,work,c->len))
+    return false;
+  memcpy(c->text,work,c->len);
+  return true;
+}
+
+/** Authenticates the header and the trailer tail of arc, storing the tag in
+ * tag if sealing, or checking it otherwise. Returns whether it matches. */
+static bool arc_sign(Arc arc, const unsigned char tail[ARC_TAIL],
+unsigned char tag[ARC_TAG], const bool seal) {
+  // Join the header and the trailer as additional data without any text
+  unsigned char aad[ARC_HEAD+ARC_TAIL];
+  arc_puthead(aad,&arc->head), memcpy(aad+ARC_HEAD,tail,ARC_TAIL);
+  CrypText data = {NULL, arc->head.nonce, 0};
+  // Produce or check the tag
+  if (seal)
+    aes_gcmseal(arc->key.gcm,&data,0xffffffff,aad,sizeof(aad),tag);
+  return seal ||
+  aes_gcmopen(arc->key.gcm,&data,0xffffffff,aad,sizeof(aad),tag);
+}
+
+/** Reads the index and the trailer that follow the end of the chunks of arc as
+ * they are found, checking them against the chunks read. */
+static bool arc_verify(Arc arc) {
+  // Compare each offset of the index
+  unsigned char buf[ARC_TAIL+ARC_TAG];
+  for (size_t i = 0; i < arc->count; ++i)
+    if (fread(buf,1,8,arc->fp) != 8 || arc_getword(buf,8) != arc->offs[i])
+      return false;
+  // Compare the trailer and check its tag
+  size_t tail = arc_tail(&arc->head);
+  if (fread(buf,1,tail,arc->fp) != tail)
+    return false;
+  return arc_getword(buf,8) == arc->pos && arc_getword(buf+8,8) ==
+  arc->count && arc_getword(buf+16,8) == arc->len &&
+  (!(arc->head.flags&ARC_AUTH) || arc_sign(arc,buf,buf+ARC_TAIL,false));
+}
+
+/** Transforms the chunks of a task, used as a thread routine. */
+static void* arc_worker(void* arg) {
+  // Get the header, followed by the length of each chunk if compressed, as
+  // additional data
+  ArcTask* task = arg;
+  Arc arc = task->arc;
+  unsigned char aad[ARC_HEAD+ARC_PREFIX];
+  arc_puthead(aad,&arc->head);
+  bool auth = arc->head.flags&ARC_AUTH, lz = arc->head.flags&ARC_LZ;
+  size_t ad = ARC_HEAD+((lz) ? ARC_PREFIX : 0);
+  // Get room to compress or decompress the chunks if necessary
+  bool work = lz && (task->mode == ARC_SEAL || task->mode == ARC_INFLATE);
+  unsigned char* buf = (work) ? MALLOC(sizeof(char)<<arc->head.shift) : NULL;
+  // Transform each chunk, with its own IV if authenticated
+  for (size_t j = 0; j < task->count; ++j) {
+    ArcChunk* c = task->chunks+j;
+    unsigned long long i = task->first+j;
+    if (task->mode == ARC_INFLATE) {
+      task->valid = arc_inflate(c,buf) && task->valid;
+      continue;
+    }
+    if (task->mode == ARC_SEAL && lz)
+      arc_deflate(c,buf);
+    else if (task->mode == ARC_SEAL)
+      c->size = c->len;
+    CrypText data = {c->text, arc->head.nonce, arc_stored(arc,c)};
+    arc_putword(aad+ARC_HEAD,c->len,ARC_PREFIX);
+    if (!auth)
+      arc_counter(arc,&data,i<<arc->head.shift,task->threads);
+    else if (task->mode == ARC_SEAL)
+      aes_gcmseal(arc->key.gcm,&data,(uint32_t)i,aad,ad,c->tag);
+    else if (task->mode == ARC_OPEN)
+      task->valid = aes_gcmopen(arc->key.gcm,&data,(uint32_t)i,aad,ad,
+      c->tag) && task->valid;
+    else
+      aes_ctr(&arc->key.gcm->aes,arc->head.nonce,(i<<32)+2,c->text,
+      data.len);
+  }
+  // Free extra memory
+  free(buf);
+  // Return nothing
+  return NULL;
+}
+
+/** Transforms the given chunks of arc, the first one being chunk first,
+ * splitting them among the given number of threads, or all processors if 0.
+ * Returns whether every tag matched. */
+static bool arc_crypt(Arc arc, ArcChunk* chunks, const size_t count,
+const unsigned long long first, const unsigned threads, const ArcMode mode) {
+  // Transform a single chunk with every thread if it allows that
+  size_t n = MIN((threads) ? threads : aes_cores(),count);
+  if (n <= 1) {
+    ArcTask task = {arc, chunks, count, first, threads, mode, true};
+    arc_worker(&task);
+    return task.valid;
+  }
+  // Split the chunks into tasks of similar size
+  ArcTask* tasks = MALLOC(sizeof(ArcTask)*n);
+  pthread_t* ids = MALLOC(sizeof(pthread_t)*n);
+  bool* started = MALLOC(sizeof(bool)*n);
+  for (size_t t = 0; t < n; ++t) {
+    size_t from = count*t/n, to = count*(t+1)/n;
+    tasks[t] = (ArcTask){arc, chunks+from, to-from, first+from, 1, mode, true};
+  }
+  // Transform the first task in this thread and the rest in new ones
+  for (size_t t = 1; t < n; ++t)
+    started[t] = !pthread_create(ids+t,NULL,arc_worker,tasks+t);
+  arc_worker(tasks);
+  // Wait for the threads, transforming here the tasks that did not start
+  bool valid = tasks[0].valid;
+  for (size_t t = 1; t < n; ++t) {
+    if (started[t])
+      pthread_join(ids[t],NULL);
+    else
+      arc_worker(tasks+t);
+    valid = valid && tasks[t].valid;
+  }
+  // Free extra memory
+  free(tasks), free(ids), free(started);
+  // Return whether every tag matched
+  return valid;
+}
+
+//_____________________________________________________________________________
+
+// ------ FUNCTIONS ------ //
+
+Arc arc_create(FILE* fp, const ArcHead* head, const ArcKey key) {
+  // Write the header
+  unsigned char buf[ARC_HEAD];
+  arc_puthead(buf,head);
+  if (fwrite(buf,1,ARC_HEAD,fp) != ARC_HEAD)
+    return NULL;
+  // Return the new archive
+  return arc_init(fp,head,key);
+}
+
+bool arc_write(Arc arc, unsigned char* text, const size_t len,
+const unsigned threads) {
+  // Describe the chunks of the text
+  unsigned long long size = 1ULL<<arc->head.shift;
+  size_t count = (size_t)arc_chunks(len,arc->head.shift);
+  ArcChunk* chunks = MALLOC(sizeof(ArcChunk)*MAX(count,1));
+  unsigned char* tags = MALLOC(sizeof(char)*ARC_TAG*MAX(count,1));
+  for (size_t i = 0; i < count; ++i) {
+    chunks[i].text = text+i*size, chunks[i].tag = tags+ARC_TAG*i;
+    chunks[i].len = (size_t)MIN(size,len-i*size);
+  }
+  // Encrypt and append them
+  arc_seal(arc,chunks,count,arc->count,threads);
+  bool success = arc_append(arc,chunks,count);
+  // Free extra memory
+  free(chunks), free(tags);
+  // Return whether everything was written
+  return success;
+}
+
+bool arc_append(Arc arc, const ArcChunk* chunks, const size_t count) {
+  // Check that the IVs of the chunks are unique
+  unsigned long long size = 1ULL<<arc->head.shift;
+  bool auth = arc->head.flags&ARC_AUTH, lz = arc->head.flags&ARC_LZ;
+  size_t pre = (lz) ? 2*ARC_PREFIX : ARC_PREFIX;
+  bool success = !arc->end && (!auth || arc->count+count < 0xffffffff);
+  // Write the lengths, the chunk and the tag of each record
+  for (size_t i = 0; success && i < count; ++i) {
+    // Check that the chunk fits and follows a full one
+    unsigned char buf[2*ARC_PREFIX];
+    size_t n = arc_stored(arc,chunks+i);
+    arc_putword(buf,chunks[i].len,ARC_PREFIX);
+    arc_putword(buf+ARC_PREFIX,n,ARC_PREFIX);
+    success = chunks[i].len && chunks[i].len <= size && n &&
+    n <= chunks[i].len && arc->len == arc->count*size &&
+    fwrite(buf,1,pre,arc->fp) == pre &&
+    fwrite(chunks[i].text,1,n,arc->fp) == n &&
+    (!auth || fwrite(chunks[i].tag,1,ARC_TAG,arc->fp) == ARC_TAG);
+    arc_push(arc,chunks[i].len,n);
+  }
+  // Return whether everything was written
+  return success;
+}
+
+bool arc_finish(Arc arc) {
+  // Write the end of the chunks
+  unsigned char buf[ARC_TAIL+ARC_TAG];
+  arc_putword(buf,0,ARC_PREFIX);
+  bool success = !arc->end && fwrite(buf,1,ARC_PREFIX,arc->fp) == ARC_PREFIX;
+  arc->pos += ARC_PREFIX, arc->end = true;
+  // Write the index
+  for (size_t i = 0; success && i < arc->count; ++i) {
+    arc_putword(buf,arc->offs[i],8);
+    success = fwrite(buf,1,8,arc->fp) == 8;
+  }
+  // Write the trailer with its tag if necessary
+  size_t tail = arc_tail(&arc->head);
+  arc_putword(buf,arc->pos,8), arc_putword(buf+8,arc->count,8);
+  arc_putword(buf+16,arc->len,8);
+  if (arc->head.flags&ARC_AUTH)
+    arc_sign(arc,buf,buf+ARC_TAIL,true);
+  // Return whether everything was written
+  return success && fwrite(buf,1,tail,arc->fp) == tail;
+}
+
+Arc arc_open(FILE* fp, const ArcHead* head, const ArcKey key) {
+  // Return the new archive
+  return arc_init(fp,head,key);
+}
+
+bool arc_next(Arc arc, unsigned char* buf, const size_t cap, size_t* len,
+const unsigned threads) {
+  // Prepare room for the chunks that fit and their tags
+  unsigned long long first = arc->count;
+  size_t most = MAX(cap>>arc->head.shift,1), count;
+  ArcChunk* chunks = MALLOC(sizeof(ArcChunk)*most);
+  unsigned char* tags = MALLOC(sizeof(char)*ARC_TAG*most);
+  for (size_t i = 0; i < most; ++i)
+    chunks[i].tag = tags+ARC_TAG*i;
+  // Read the chunks and decrypt them
+  bool valid = arc_take(arc,buf,cap,chunks,&count) &&
+  arc_unseal(arc,chunks,count,first,threads);
+  *len = 0;
+  for (size_t i = 0; i < count; ++i)
+    *len += chunks[i].len;
+  // Free extra memory
+  free(chunks), free(tags);
+  // Return whether they were read and verified
+  return valid;
+}
+
+bool arc_take(Arc arc, unsigned char* buf, const size_t cap, ArcChunk* chunks,
+size_t* count) {
+  // Read the next chunks while they fit, checking the rest at the end
+  unsigned long long size = 1ULL<<arc->head.shift;
+  size_t most = MAX(cap/size,1), len = 0;
+  bool auth = arc->head.flags&ARC_AUTH, lz = arc->head.flags&ARC_LZ;
+  bool valid = true;
+  *count = 0;
+  while (valid && !arc->end && *count < most) {
+    unsigned char pre[ARC_PREFIX];
+    valid = fread(pre,1,ARC_PREFIX,arc->fp) == ARC_PREFIX;
+    unsigned long long n = arc_getword(pre,ARC_PREFIX), stored = n;
+    if (valid && !n) {
+      arc->pos += ARC_PREFIX, arc->end = true, valid = arc_verify(arc);
+      break;
+    }
+    // Read the length as stored of a compressed archive
+    if (valid && lz) {
+      valid = fread(pre,1,ARC_PREFIX,arc->fp) == ARC_PREFIX;
+      stored = arc_getword(pre,ARC_PREFIX);
+    }
+    // Check that the chunk fits and follows a full one, then read it
+    ArcChunk* c = chunks+*count;
+    c->text = buf+len, c->len = (size_t)n, c->size = (size_t)stored;
+    valid = valid && n <= size && stored && stored <= n &&
+    arc->len == arc->count*size &&
+    fread(c->text,1,c->size,arc->fp) == stored &&
+    (!auth || fread(c->tag,1,ARC_TAG,arc->fp) == ARC_TAG);
+    if (valid)
+      arc_push(arc,c->len,c->size), len += c->len, ++*count;
+  }
+  // Return whether they were read
+  return valid;
+}
+
+bool arc_index(Arc arc) {
+  // Read the trailer at the end of the file and check its tag
+  unsigned char buf[ARC_TAIL+ARC_TAG];
+  unsigned long long size;
+  size_t tail = arc_tail(&arc->head);
+  if (!arc_length(arc->fp,&size) || size < ARC_HEAD+ARC_PREFIX+tail ||
+  !arc_goto(arc->fp,size-tail) || fread(buf,1,tail,arc->fp) != tail ||
+  ((arc->head.flags&ARC_AUTH) && !arc_sign(arc,buf,buf+ARC_TAIL,false)))
+    return false;
+  unsigned long long idx = arc_getword(buf,8), count = arc_getword(buf+8,8);
+  unsigned long long len = arc_getword(buf+16,8);
+  // Check that the index fills the space between the chunks and the trailer
+  if (idx < ARC_HEAD+ARC_PREFIX || idx > size-tail ||
+  (size-tail-idx)%8 || (size-tail-idx)/8 != count ||
+  count != arc_chunks(len,arc->head.shift))
+    return false;
+  // Check the end of the chunks
+  bool valid = arc_goto(arc->fp,idx-ARC_PREFIX) &&
+  fread(buf,1,ARC_PREFIX,arc->fp) == ARC_PREFIX &&
+  !arc_getword(buf,ARC_PREFIX);
+  // Read the offsets, which must be increasing records before the end
+  unsigned long long* offs = MALLOC(sizeof(unsigned long long)*MAX(count,1));
+  for (size_t i = 0; valid && i < count; ++i) {
+    valid = fread(buf,1,8,arc->fp) == 8, offs[i] = arc_getword(buf,8);
+    valid = valid && ((i) ? offs[i] > offs[i-1]+ARC_PREFIX :
+    offs[i] == ARC_HEAD);
+  }
+  valid = valid && ((count) ? offs[count-1]+ARC_PREFIX < idx-ARC_PREFIX :
+  idx == ARC_HEAD+ARC_PREFIX);
+  if (!valid)
+    return free(offs), false;
+  // Replace the known chunks with the index
+  free(arc->offs), arc->offs = offs;
+  arc->count = (size_t)count, arc->cap = (size_t)MAX(count,1);
+  arc->len = len, arc->pos = idx, arc->end = true;
+  // Return success
+  return true;
+}
+
+size_t arc_read(Arc arc, const unsigned long long offset, unsigned char* buf,
+const size_t len) {
+  // Load the index if it is not known yet
+  if (!arc->end && !arc_index(arc))
+    return 0;
+  // Authenticated or compressed chunks are read whole into a reusable buffer
+  unsigned long long size = 1ULL<<arc->head.shift, pos = offset;
+  bool auth = arc->head.flags&ARC_AUTH, lz = arc->head.flags&ARC_LZ;
+  unsigned char* whole = (auth || lz) ?
+  MALLOC(sizeof(char)*(size+ARC_TAG)) : NULL;
+  // Read up to the end of the plaintext
+  size_t done = 0, total = (offset < arc->len) ?
+  (size_t)MIN(len,arc->len-offset) : 0;
+  while (done < total) {
+    // Locate the bytes inside their chunk
+    unsigned long long i = pos>>arc->head.shift, skip = pos&(size-1);
+    size_t n = (size_t)MIN(total-done,size-skip);
+    size_t full = (size_t)MIN(size,arc->len-i*size);
+    // Check the length of the chunk and its length as stored
+    unsigned char pre[ARC_PREFIX];
+    size_t stored = full;
+    if (!arc_goto(arc->fp,arc->offs[i]) ||
+    fread(pre,1,ARC_PREFIX,arc->fp) != ARC_PREFIX ||
+    arc_getword(pre,ARC_PREFIX) != full || (lz &&
+    (fread(pre,1,ARC_PREFIX,arc->fp) != ARC_PREFIX ||
+    (stored = (size_t)arc_getword(pre,ARC_PREFIX)) > full || !stored)))
+      break;
+    // Decrypt, verify and decompress the whole chunk, then take the bytes
+    // needed
+    if (auth || lz) {
+      ArcChunk c = {whole, full, whole+stored, stored};
+      size_t rec = stored+((auth) ? ARC_TAG : 0);
+      if (fread(whole,1,rec,arc->fp) != rec || !arc_unseal(arc,&c,1,i,0))
+        break;
+      memcpy(buf+done,whole+skip,n);
+    }
+    // Or read only those bytes and decrypt them at their offset
+    else {
+      CrypText data = {buf+done, arc->head.nonce, n};
+      if (!arc_goto(arc->fp,arc->offs[i]+ARC_PREFIX+skip) ||
+      fread(buf+done,1,n,arc->fp) != n)
+        break;
+      arc_counter(arc,&data,pos,0);
+    }
+    done += n, pos += n;
+  }
+  // Free extra memory
+  free(whole);
+  // Return the number of bytes read
+  return done;
+}
+
+void arc_delete(Arc arc) {
+  // Free the offsets and the archive
+  free(arc->offs), free(arc);
+}
+
+//_____________________________________________________________________________
+
+// ------ AUXILIARIES ------ //
+
+bool arc_check(const unsigned char* buf) {
+  // Compare the magic bytes
+  return !memcmp(buf,ARC_MAGIC,4);
+}
+
+void arc_puthead(unsigned char buf[ARC_HEAD], const ArcHead* head) {
+  // Write the magic bytes, the settings and the nonce
+  memcpy(buf,ARC_MAGIC,4);
+  buf[4] = head->version, buf[5] = head->cipher;
+  buf[6] = head->flags, buf[7] = head->shift;
+  arc_putword(buf+8,head->nonce,8);
+}
+
+bool arc_gethead(const unsigned char buf[ARC_HEAD], ArcHead* head) {
+  // Read the settings and the nonce
+  head->version = buf[4], head->cipher = buf[5];
+  head->flags = buf[6], head->shift = buf[7];
+  head->nonce = arc_getword(buf+8,8);
+  // Return whether they are supported
+  return arc_check(buf) && head->version && head->version <= ARC_VERSION &&
+  arc_keysize(head->cipher) && !(head->flags&~(ARC_AUTH|ARC_LZ)) &&
+  (head->cipher != ARC_CHACHA || !(head->flags&ARC_AUTH)) &&
+  head->shift >= ARC_MINSHIFT && head->shift <= ARC_MAXSHIFT;
+}
+
+size_t arc_keysize(const unsigned char cipher) {
+  // Map the cipher to the size of its key
+  switch (cipher) {
+    case ARC_AES128:
+      return AES_128;
+    case ARC_AES192:
+      return AES_192;
+    case ARC_AES256:
+    case ARC_CHACHA:
+      return 32;
+    default:
+      return 0;
+  }
+}
+
+unsigned char arc_cipher(const AesSize size) {
+  // Map the size of the key to its cipher
+  switch (size) {
+    case AES_128:
+      return ARC_AES128;
+    case AES_192:
+      return ARC_AES192;
+    default:
+      return ARC_AES256;
+  }
+}
+
+void arc_putword(unsigned char* buf, const unsigned long long word,
+const size_t bytes) {
+  // Write the most significant bytes first
+  for (size_t i = 0; i < bytes; ++i)
+    buf[i] = (unsigned char)(word>>(8*(bytes-1-i)));
+}
+
+unsigned long long arc_getword(const unsigned char* buf, const size_t bytes) {
+  // Read the most significant bytes first
+  unsigned long long word = 0;
+  for (size_t i = 0; i < bytes; ++i)
+    word = word<<8|buf[i];
+  return word;
+}
+
+unsigned long long arc_chunks(const unsigned long long len,
+const unsigned char shift) {
+  // Count the full chunks and the partial one if there is any
+  return (len>>shift)+!!(len&((1ULL<<shift)-1));
+}
+
+unsigned long long arc_record(const ArcHead* head,
+const unsigned long long len) {
+  // Add the prefixes and the tag if there is one
+  return ((head->flags&ARC_LZ) ? 2*ARC_PREFIX : ARC_PREFIX)+len+
+  ((head->flags&ARC_AUTH) ? ARC_TAG : 0);
+}
+
+size_t arc_tail(const ArcHead* head) {
+  // Add the tag if there is one
+  return ARC_TAIL+((head->flags&ARC_AUTH) ? ARC_TAG : 0);
+}
+
+unsigned long long arc_offset(const ArcHead* head,
+const unsigned long long i) {
+  // Skip the header and the previous records
+  return ARC_HEAD+i*arc_record(head,1ULL<<head->shift);
+}
+
+unsigned long long arc_size(const ArcHead* head,
+const unsigned long long len) {
+  // Add the header, the records, the end, the index and the trailer
+  unsigned long long count = arc_chunks(len,head->shift);
+  return ARC_HEAD+count*(arc_record(head,0)+8)+len+ARC_PREFIX+arc_tail(head);
+}
+
+void arc_frame(Arc arc, unsigned char* buf, const unsigned long long len) {
+  // Locate the index
+  const ArcHead* head = &arc->head;
+  unsigned long long count = arc_chunks(len,head->shift);
+  unsigned long long idx = ARC_HEAD+count*arc_record(head,0)+len+ARC_PREFIX;
+  unsigned long long size = 1ULL<<head->shift;
+  // Write the header, the length of each chunk and its offset
+  arc_puthead(buf,head);
+  for (unsigned long long i = 0; i < count; ++i) {
+    unsigned long long off = arc_offset(head,i);
+    arc_putword(buf+off,MIN(size,len-i*size),ARC_PREFIX);
+    arc_putword(buf+idx+8*i,off,8);
+  }
+  // Write the end of the chunks and the trailer with its tag if necessary
+  unsigned char* tail = buf+idx+8*count;
+  arc_putword(buf+idx-ARC_PREFIX,0,ARC_PREFIX);
+  arc_putword(tail,idx,8), arc_putword(tail+8,count,8);
+  arc_putword(tail+16,len,8);
+  if (head->flags&ARC_AUTH)
+    arc_sign(arc,tail,tail+ARC_TAIL,true);
+}
+
+void arc_seal(Arc arc, ArcChunk* chunks, const size_t count,
+const unsigned long long first, const unsigned threads) {
+  // Encrypt the chunks and produce their tags
+  arc_crypt(arc,chunks,count,first,threads,ARC_SEAL);
+}
+
+bool arc_unseal(Arc arc, ArcChunk* chunks, const size_t count,
+const unsigned long long first, const unsigned threads) {
+  // Decrypt the chunks and check their tags, then decompress them
+  if (arc_crypt(arc,chunks,count,first,threads,ARC_OPEN))
+    return !(arc->head.flags&ARC_LZ) ||
+    arc_crypt(arc,chunks,count,first,threads,ARC_INFLATE);
+  // Encrypt them back if any tag did not match
+  arc_crypt(arc,chunks,count,first,threads,ARC_XOR);
+  return false;
+}
+
+bool arc_goto(FILE* fp, const unsigned long long offset) {
+  // Seek with 64-bit offsets
+#if defined(_WIN32)
+  return !_fseeki64(fp,(long long)offset,SEEK_SET);
+#else
+  return !fseeko(fp,(off_t)offset,SEEK_SET);
+#endif // _WIN32
+}
+
+//_____________________________________________________________________________
+
+#endif // __ARCHIVE_C__
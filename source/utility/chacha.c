@@ -0,0 +1,466 @@
+/// SOURCE - CHACHA
+/** Source file for a ChaCha20 stream cipher implementation. */
+#ifndef __CHACHA_C__
+#define __CHACHA_C__
+
+//_____________________________________________________________________________
+
+// ------ INCLUDES ------ //
+
+#include "../../include/chacha.h"
+#include <string.h>
+#include <pthread.h>
+
+//_____________________________________________________________________________
+
+// ------ MACROS ------ //
+
+/** Indicates if the vector implementations are available to compile. */
+#ifndef CHACHA_X86
+#if defined(__x86_64__) || defined(__i386__)
+#define CHACHA_X86 1
+#else
+#define CHACHA_X86 0
+#endif // __x86_64__ || __i386__
+#endif // CHACHA_X86
+
+/** Number of blocks of keystream generated at once. */
+#ifndef CHACHA_BATCH
+#define CHACHA_BATCH ((size_t)16)
+#endif // CHACHA_BATCH
+
+/** Minimum number of bytes worth handing to a separate thread. */
+#ifndef CHACHA_MINSPLIT
+#define CHACHA_MINSPLIT ((size_t)1<<16)
+#endif // CHACHA_MINSPLIT
+
+/** Adds and xors two words of the scalar state. */
+#ifndef CHACHA_ADD
+#define CHACHA_ADD(a,b) ((a)+(b))
+#endif // CHACHA_ADD
+#ifndef CHACHA_XOR
+#define CHACHA_XOR(a,b) ((a)^(b))
+#endif // CHACHA_XOR
+
+/** Applies a quarter round to the words a, b, c and d of the state x, with
+ * the given operations to add, xor and rotate its words. */
+#ifndef CHACHA_QUARTER
+#define CHACHA_QUARTER(x,a,b,c,d,add,eor,rot) \
+  ((x)[a] = add((x)[a],(x)[b]), (x)[d] = rot(eor((x)[d],(x)[a]),16), \
+  (x)[c] = add((x)[c],(x)[d]), (x)[b] = rot(eor((x)[b],(x)[c]),12), \
+  (x)[a] = add((x)[a],(x)[b]), (x)[d] = rot(eor((x)[d],(x)[a]),8), \
+  (x)[c] = add((x)[c],(x)[d]), (x)[b] = rot(eor((x)[b],(x)[c]),7))
+#endif // CHACHA_QUARTER
+
+/** Applies a column round and a diagonal round to the state x. */
+#ifndef CHACHA_DOUBLE
+#define CHACHA_DOUBLE(x,add,eor,rot) \
+  (CHACHA_QUARTER(x,0,4,8,12,add,eor,rot), \
+  CHACHA_QUARTER(x,1,5,9,13,add,eor,rot), \
+  CHACHA_QUARTER(x,2,6,10,14,add,eor,rot), \
+  CHACHA_QUARTER(x,3,7,11,15,add,eor,rot), \
+  CHACHA_QUARTER(x,0,5,10,15,add,eor,rot), \
+  CHACHA_QUARTER(x,1,6,11,12,add,eor,rot), \
+  CHACHA_QUARTER(x,2,7,8,13,add,eor,rot), \
+  CHACHA_QUARTER(x,3,4,9,14,add,eor,rot))
+#endif // CHACHA_DOUBLE
+
+#if CHACHA_X86
+#include <immintrin.h>
+#endif // CHACHA_X86
+
+//_____________________________________________________________________________
+
+// ------ TYPES ------ //
+
+/** Range of a text transformed by a single thread. */
+typedef struct _ChachaRange {
+  Chacha cc; // stream cipher context
+  unsigned long long nonce, block; // nonce and first block of the range
+  unsigned char* text; // start of the range
+  size_t len; // length of the range
+} /** Text range type alias. */ ChachaRange;
+
+//_____________________________________________________________________________
+
+// ------ VARIABLES ------ //
+
+/** Implementation used by the stream cipher, negative until it is chosen,
+ * atomic since chacha_select may replace it while other threads read it. */
+static _Atomic int chachaimpl = -1;
+
+/** Guard that chooses the implementation once. */
+static pthread_once_t chachaimplonce = PTHREAD_ONCE_INIT;
+
+//_____________________________________________________________________________
+
+// ------ STATICS ------ //
+
+/** Rotates the word x left by n bits. */
+static inline uint32_t chacha_rotl(const uint32_t x, const int n) {
+  // Join both ends of the word
+  return x<<n|x>>(32-n);
+}
+
+/** Reads a little-endian word from buf. */
+static inline uint32_t chacha_getword(const unsigned char* buf) {
+  // Join the bytes from the least significant one
+  return (uint32_t)buf[0]|(uint32_t)buf[1]<<8|(uint32_t)buf[2]<<16|
+  (uint32_t)buf[3]<<24;
+}
+
+/** Writes the word w into buf, little-endian. */
+static inline void chacha_putword(unsigned char* buf, const uint32_t w) {
+  // Split the word from the least significant byte
+  buf[0] = (unsigned char)w, buf[1] = (unsigned char)(w>>8);
+  buf[2] = (unsigned char)(w>>16), buf[3] = (unsigned char)(w>>24);
+}
+
+/** Fills the state s of the first block of keystream, whose counter is the
+ * given block. */
+static void chacha_state(Chacha cc, const unsigned long long nonce,
+const unsigned long long block, uint32_t s[16]) {
+  // Write the constants, the key, the counter and the nonce
+  s[0] = 0x61707865, s[1] = 0x3320646e, s[2] = 0x79622d32, s[3] = 0x6b206574;
+  memcpy(s+4,cc->key,sizeof(cc->key));
+  s[12] = (uint32_t)block, s[13] = (uint32_t)(block>>32);
+  s[14] = (uint32_t)nonce, s[15] = (uint32_t)(nonce>>32);
+}
+
+/** Stores in ks the block of keystream that follows by first blocks the one
+ * of the state s. */
+static void chacha_scalarblock(const uint32_t s[16], const size_t first,
+unsigned char ks[64]) {
+  // Copy the state with the counter of the block
+  uint32_t x[16], v[16];
+  unsigned long long count = ((unsigned long long)s[13]<<32|s[12])+first;
+  memcpy(v,s,sizeof(v));
+  v[12] = (uint32_t)count, v[13] = (uint32_t)(count>>32);
+  memcpy(x,v,sizeof(x));
+  // Apply the rounds and add the state back
+  for (int r = 0; r < 10; ++r)
+    CHACHA_DOUBLE(x,CHACHA_ADD,CHACHA_XOR,chacha_rotl);
+  for (int i = 0; i < 16; ++i)
+    chacha_putword(ks+4*i,x[i]+v[i]);
+}
+
+/** Fills the counters lo and hi of the given number of lanes, the first one
+ * following by first blocks the one of the state s. */
+static void chacha_lanes(const uint32_t s[16], const size_t first,
+uint32_t* lo, uint32_t* hi, const size_t lanes) {
+  // Count from the block of the first lane, carrying into the high word
+  unsigned long long count = ((unsigned long long)s[13]<<32|s[12])+first;
+  for (size_t l = 0; l < lanes; ++l, ++count)
+    lo[l] = (uint32_t)count, hi[l] = (uint32_t)(count>>32);
+}
+
+#if CHACHA_X86
+
+/** Rotates the words of x left by n bits with SSE2 instructions. */
+__attribute__((target("sse2"),always_inline))
+static inline __m128i chacha_sserot(const __m128i x, const int n) {
+  // Swap the halves of each word or join both ends of it
+  if (n == 16)
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x,0xb1),0xb1);
+  return _mm_or_si128(_mm_slli_epi32(x,n),_mm_srli_epi32(x,32-n));
+}
+
+/** Stores in ks the blocks of keystream that follow by first blocks the one
+ * of the state s, four at a time with SSE2 instructions, each lane of the
+ * registers holding a block. Returns the number of blocks stored. */
+__attribute__((target("sse2")))
+static size_t chacha_sse2blocks(const uint32_t s[16], const size_t first,
+unsigned char* ks, const size_t n) {
+  // Broadcast the state to the lanes
+  __m128i v[16];
+  for (int w = 0; w < 16; ++w)
+    v[w] = _mm_set1_epi32((int)s[w]);
+  size_t i = 0;
+  for (; i+4 <= n; i += 4) {
+    // Give each lane its counter and apply the rounds
+    uint32_t lo[4], hi[4];
+    chacha_lanes(s,first+i,lo,hi,4);
+    v[12] = _mm_loadu_si128((const __m128i*)lo);
+    v[13] = _mm_loadu_si128((const __m128i*)hi);
+    __m128i x[16];
+    memcpy(x,v,sizeof(x));
+    for (int r = 0; r < 10; ++r)
+      CHACHA_DOUBLE(x,_mm_add_epi32,_mm_xor_si128,chacha_sserot);
+    // Add the state back and transpose each group of four words
+    for (int g = 0; g < 4; ++g) {
+      __m128i a = _mm_add_epi32(x[4*g],v[4*g]);
+      __m128i b = _mm_add_epi32(x[4*g+1],v[4*g+1]);
+      __m128i c = _mm_add_epi32(x[4*g+2],v[4*g+2]);
+      __m128i d = _mm_add_epi32(x[4*g+3],v[4*g+3]);
+      __m128i t0 = _mm_unpacklo_epi32(a,b), t1 = _mm_unpacklo_epi32(c,d);
+      __m128i t2 = _mm_unpackhi_epi32(a,b), t3 = _mm_unpackhi_epi32(c,d);
+      unsigned char* p = ks+64*i+16*(size_t)g;
+      _mm_storeu_si128((__m128i*)p,_mm_unpacklo_epi64(t0,t1));
+      _mm_storeu_si128((__m128i*)(p+64),_mm_unpackhi_epi64(t0,t1));
+      _mm_storeu_si128((__m128i*)(p+128),_mm_unpacklo_epi64(t2,t3));
+      _mm_storeu_si128((__m128i*)(p+192),_mm_unpackhi_epi64(t2,t3));
+    }
+  }
+  // Return the number of blocks stored
+  return i;
+}
+
+/** Rotates the words of x left by n bits with AVX2 instructions. */
+__attribute__((target("avx2"),always_inline))
+static inline __m256i chacha_avxrot(const __m256i x, const int n) {
+  // Move whole bytes or join both ends of each word
+  if (n == 16)
+    return _mm256_shuffle_epi8(x,_mm256_setr_epi8(2,3,0,1,6,7,4,5,10,11,8,
+    9,14,15,12,13,2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13));
+  if (n == 8)
+    return _mm256_shuffle_epi8(x,_mm256_setr_epi8(3,0,1,2,7,4,5,6,11,8,9,
+    10,15,12,13,14,3,0,1,2,7,4,5,6,11,8,9,10,15,12,13,14));
+  return _mm256_or_si256(_mm256_slli_epi32(x,n),_mm256_srli_epi32(x,32-n));
+}
+
+/** Stores in ks the blocks of keystream that follow by first blocks the one
+ * of the state s, eight at a time with AVX2 instructions, each lane of the
+ * registers holding a block. Returns the number of blocks stored. */
+__attribute__((target("avx2")))
+static size_t chacha_avx2blocks(const uint32_t s[16], const size_t first,
+unsigned char* ks, const size_t n) {
+  // Broadcast the state to the lanes
+  __m256i v[16];
+  for (int w = 0; w < 16; ++w)
+    v[w] = _mm256_set1_epi32((int)s[w]);
+  size_t i = 0;
+  for (; i+8 <= n; i += 8) {
+    // Give each lane its counter and apply the rounds
+    uint32_t lo[8], hi[8];
+    chacha_lanes(s,first+i,lo,hi,8);
+    v[12] = _mm256_loadu_si256((const __m256i*)lo);
+    v[13] = _mm256_loadu_si256((const __m256i*)hi);
+    __m256i x[16];
+    memcpy(x,v,sizeof(x));
+    for (int r = 0; r < 10; ++r)
+      CHACHA_DOUBLE(x,_mm256_add_epi32,_mm256_xor_si256,chacha_avxrot);
+    // Add the state back and transpose each group of four words, which
+    // leaves the first four blocks in the low halves
+    __m256i t[4][4];
+    for (int g = 0; g < 4; ++g) {
+      __m256i a = _mm256_add_epi32(x[4*g],v[4*g]);
+      __m256i b = _mm256_add_epi32(x[4*g+1],v[4*g+1]);
+      __m256i c = _mm256_add_epi32(x[4*g+2],v[4*g+2]);
+      __m256i d = _mm256_add_epi32(x[4*g+3],v[4*g+3]);
+      __m256i t0 = _mm256_unpacklo_epi32(a,b), t1 = _mm256_unpacklo_epi32(c,d);
+      __m256i t2 = _mm256_unpackhi_epi32(a,b), t3 = _mm256_unpackhi_epi32(c,d);
+      t[g][0] = _mm256_unpacklo_epi64(t0,t1);
+      t[g][1] = _mm256_unpackhi_epi64(t0,t1);
+      t[g][2] = _mm256_unpacklo_epi64(t2,t3);
+      t[g][3] = _mm256_unpackhi_epi64(t2,t3);
+    }
+    // Join the halves of two groups to store 32 bytes of a block at once
+    for (int g = 0; g < 4; g += 2)
+      for (int l = 0; l < 4; ++l) {
+        unsigned char* p = ks+64*(i+(size_t)l)+16*(size_t)g;
+        _mm256_storeu_si256((__m256i*)p,
+        _mm256_permute2x128_si256(t[g][l],t[g+1][l],0x20));
+        _mm256_storeu_si256((__m256i*)(p+256),
+        _mm256_permute2x128_si256(t[g][l],t[g+1][l],0x31));
+      }
+  }
+  // Return the number of blocks stored
+  return i;
+}
+
+#endif // CHACHA_X86
+
+/** Transforms the given text range, used as a thread routine. */
+static void* chacha_worker(void* arg) {
+  // Xor the range with its keystream
+  ChachaRange* range = arg;
+  chacha_stream(range->cc,range->nonce,range->block,range->text,range->len);
+  // Return nothing
+  return NULL;
+}
+
+/** Chooses the widest implementation that the processor supports, used as a
+ * once routine. */
+static void chacha_choose(void) {
+  // Check the implementations from the widest one
+  int impl = CHACHA_SCALAR;
+  if (chacha_supports(CHACHA_AVX2))
+    impl = CHACHA_AVX2;
+  else if (chacha_supports(CHACHA_SSE2))
+    impl = CHACHA_SSE2;
+  // Publish the choice
+  chachaimpl = impl;
+}
+
+//_____________________________________________________________________________
+
+// ------ FUNCTIONS ------ //
+
+void chacha_transform(CrypText* data, const unsigned char key[32]) {
+  // Xor the text with the keystream in this thread
+  struct _Chacha cc;
+  chacha_init(&cc,key);
+  chacha_counter(&cc,data,0,1);
+}
+
+void chacha_parallel(CrypText* data, const unsigned char key[32],
+const unsigned threads) {
+  // Xor the text with the keystream, splitting it among the threads
+  struct _Chacha cc;
+  chacha_init(&cc,key);
+  chacha_counter(&cc,data,0,threads);
+}
+
+Chacha chacha_create(const unsigned char key[32]) {
+  // Allocate the context and store the key into it
+  Chacha cc = MALLOC(sizeof(struct _Chacha));
+  chacha_init(cc,key);
+  // Return the new context
+  return cc;
+}
+
+void chacha_counter(Chacha cc, CrypText* data,
+const unsigned long long offset, const unsigned threads) {
+  // Xor the text with the keystream, starting at the given offset
+  chacha_seek(cc,data->nonce,offset,data->text,data->len,threads);
+}
+
+void chacha_delete(Chacha cc) {
+  // Wipe the key before freeing the context
+  volatile uint32_t* key = cc->key;
+  for (int i = 0; i < 8; ++i)
+    key[i] = 0;
+  free(cc);
+}
+
+ChachaImpl chacha_impl(void) {
+  // Choose the widest supported implementation once
+  pthread_once(&chachaimplonce,chacha_choose);
+  // Return the chosen implementation
+  return (ChachaImpl)chachaimpl;
+}
+
+bool chacha_select(const ChachaImpl impl) {
+  // Choose the implementation only if the processor supports it, after the
+  // default one so that it is not overwritten
+  pthread_once(&chachaimplonce,chacha_choose);
+  bool supported = chacha_supports(impl);
+  if (supported)
+    chachaimpl = (int)impl;
+  // Return whether the implementation was chosen
+  return supported;
+}
+
+//_____________________________________________________________________________
+
+// ------ AUXILIARIES ------ //
+
+void chacha_init(Chacha cc, const unsigned char key[32]) {
+  // Store the key words and fix the implementation
+  for (int i = 0; i < 8; ++i)
+    cc->key[i] = chacha_getword(key+4*i);
+  cc->impl = chacha_impl();
+}
+
+void chacha_blocks(Chacha cc, const unsigned long long nonce,
+const unsigned long long block, unsigned char* ks, const size_t n) {
+  // Generate the blocks with the widest registers first
+  uint32_t s[16];
+  chacha_state(cc,nonce,block,s);
+  size_t i = 0;
+#if CHACHA_X86
+  if (cc->impl == CHACHA_AVX2)
+    i = chacha_avx2blocks(s,0,ks,n);
+  if (cc->impl != CHACHA_SCALAR)
+    i += chacha_sse2blocks(s,i,ks+64*i,n-i);
+#endif // CHACHA_X86
+  // Generate the remaining blocks one by one
+  for (; i < n; ++i)
+    chacha_scalarblock(s,i,ks+64*i);
+}
+
+void chacha_stream(Chacha cc, const unsigned long long nonce,
+const unsigned long long block, unsigned char* text, const size_t len) {
+  // Process the text in batches of keystream blocks
+  _Alignas(64) unsigned char ks[64*CHACHA_BATCH];
+  unsigned long long count = block;
+  for (size_t i = 0; i < len; i += 64*CHACHA_BATCH, count += CHACHA_BATCH) {
+    size_t n = MIN(64*CHACHA_BATCH,len-i);
+    chacha_blocks(cc,nonce,count,ks,(n+63)/64);
+    aes_xor(text+i,ks,n);
+  }
+}
+
+void chacha_split(Chacha cc, const unsigned long long nonce,
+const unsigned long long block, unsigned char* text, const size_t len,
+const unsigned threads) {
+  // Avoid threads that would not have enough work to pay for themselves
+  size_t n = (threads) ? threads : aes_cores();
+  size_t most = (len+CHACHA_MINSPLIT-1)/CHACHA_MINSPLIT;
+  if (n > most)
+    n = most;
+  if (n <= 1) {
+    chacha_stream(cc,nonce,block,text,len);
+    return;
+  }
+  // Split the text into block-aligned ranges of similar length
+  ChachaRange* ranges = MALLOC(sizeof(ChachaRange)*n);
+  pthread_t* ids = MALLOC(sizeof(pthread_t)*n);
+  bool* started = MALLOC(sizeof(bool)*n);
+  size_t blocks = (len+63)/64, each = blocks/n, extra = blocks%n;
+  for (size_t i = 0, first = 0; i < n; ++i) {
+    size_t size = each+(i < extra);
+    ranges[i].cc = cc, ranges[i].nonce = nonce, ranges[i].block = block+first;
+    ranges[i].text = text+64*first;
+    ranges[i].len = (i+1 < n) ? 64*size : len-64*first;
+    first += size;
+  }
+  // Transform the first range in this thread and the rest in new ones
+  for (size_t i = 1; i < n; ++i)
+    started[i] = !pthread_create(ids+i,NULL,chacha_worker,ranges+i);
+  chacha_worker(ranges);
+  // Wait for the threads, transforming here the ranges that did not start
+  for (size_t i = 1; i < n; ++i) {
+    if (started[i])
+      pthread_join(ids[i],NULL);
+    else
+      chacha_worker(ranges+i);
+  }
+  // Free extra memory
+  free(ranges), free(ids), free(started);
+}
+
+void chacha_seek(Chacha cc, const unsigned long long nonce,
+const unsigned long long offset, unsigned char* text, const size_t len,
+const unsigned threads) {
+  // Xor the end of the first block if the offset falls inside it
+  unsigned long long block = offset/64;
+  size_t skip = (size_t)(offset%64), head = 0;
+  if (skip && len) {
+    unsigned char ks[64];
+    chacha_blocks(cc,nonce,block++,ks,1);
+    head = MIN(64-skip,len);
+    aes_xor(text,ks+skip,head);
+  }
+  // Xor the rest of the text from the next block boundary
+  chacha_split(cc,nonce,block,text+head,len-head,threads);
+}
+
+bool chacha_supports(const ChachaImpl impl) {
+  // Scalar operations are always supported
+  bool supported = impl == CHACHA_SCALAR;
+#if CHACHA_X86
+  // Check the processor features needed by the vector implementations
+  __builtin_cpu_init();
+  if (impl == CHACHA_SSE2)
+    supported = __builtin_cpu_supports("sse2");
+  else if (impl == CHACHA_AVX2)
+    supported = __builtin_cpu_supports("avx2");
+#endif // CHACHA_X86
+  // Return whether the implementation is supported
+  return supported;
+}
+
+//_____________________________________________________________________________
+
+#endif // __CHACHA_C__
@@ -0,0 +1,205 @@
+/// SOURCE - COMPRESSION
+/** Source file for a fast LZ77 compressor of independent blocks. */
+#ifndef __LZ_C__
+#define __LZ_C__
+
+//_____________________________________________________________________________
+
+// ------ INCLUDES ------ //
+
+#include "../../include/lz.h"
+#include <stdint.h>
+#include <string.h>
+
+//_____________________________________________________________________________
+
+// ------ MACROS ------ //
+
+/** Shortest match that is encoded. */
+#ifndef LZ_MINMATCH
+#define LZ_MINMATCH ((size_t)4)
+#endif // LZ_MINMATCH
+
+/** Farthest distance of a match. */
+#ifndef LZ_MAXDIST
+#define LZ_MAXDIST ((size_t)65535)
+#endif // LZ_MAXDIST
+
+/** Base 2 logarithm of the number of entries of the table of positions. */
+#ifndef LZ_HASHBITS
+#define LZ_HASHBITS 12
+#endif // LZ_HASHBITS
+
+/** Base 2 logarithm of the number of failed searches after which the step
+ * of the search grows by one byte, so that incompressible data is skipped
+ * quickly. */
+#ifndef LZ_SKIP
+#define LZ_SKIP 6
+#endif // LZ_SKIP
+
+/** Value of a nibble of a token whose length continues in extra bytes. */
+#ifndef LZ_NIBBLE
+#define LZ_NIBBLE ((size_t)15)
+#endif // LZ_NIBBLE
+
+//_____________________________________________________________________________
+
+// ------ STATICS ------ //
+
+/** Reads the 4 bytes at p as a word, in the order of the processor. */
+static inline uint32_t lz_load(const unsigned char* p) {
+  // Copy them without alignment requirements
+  uint32_t w;
+  memcpy(&w,p,sizeof(w));
+  return w;
+}
+
+/** Reads the 8 bytes at p as a word, in the order of the processor. */
+static inline uint64_t lz_wide(const unsigned char* p) {
+  // Copy them without alignment requirements
+  uint64_t w;
+  memcpy(&w,p,sizeof(w));
+  return w;
+}
+
+/** Returns the entry of the table of positions of the word w. */
+static inline size_t lz_hash(const uint32_t w) {
+  // Keep the highest bits of a multiplicative hash
+  return (size_t)((w*2654435761u)>>(32-LZ_HASHBITS));
+}
+
+/** Returns the number of extra bytes of a length n of a token. */
+static inline size_t lz_extra(const size_t n) {
+  // Count a byte for each 255 beyond the nibble and the last one
+  return (n >= LZ_NIBBLE) ? (n-LZ_NIBBLE)/255+1 : 0;
+}
+
+/** Writes the extra bytes of a length n of a token into dst. */
+static inline unsigned char* lz_putlen(unsigned char* dst, size_t n) {
+  // Write 255 while it does not fit in a byte, then the rest
+  if (n < LZ_NIBBLE)
+    return dst;
+  for (n -= LZ_NIBBLE; n >= 255; n -= 255)
+    *dst++ = 255;
+  *dst++ = (unsigned char)n;
+  return dst;
+}
+
+/** Adds to n the extra bytes of a length of a token of the block src of len
+ * bytes at position i, moving past them. Returns whether they fit. */
+static inline bool lz_getlen(const unsigned char* src, const size_t len,
+size_t* i, size_t* n) {
+  // Add bytes until one is not 255
+  unsigned char b = 255;
+  while (b == 255 && *i < len)
+    b = src[(*i)++], *n += b;
+  return b != 255;
+}
+
+/** Writes into dst, at position pos of cap bytes, a sequence of the given
+ * literals followed by a match of mlen bytes at the given distance, or no
+ * match if mlen is 0. Returns the next position, or 0 if it does not fit. */
+static size_t lz_sequence(unsigned char* dst, const size_t pos,
+const size_t cap, const unsigned char* lits, const size_t nlits,
+const size_t dist, const size_t mlen) {
+  // Check the room of the whole sequence
+  size_t mext = (mlen) ? mlen-LZ_MINMATCH : 0;
+  size_t need = 1+lz_extra(nlits)+nlits+((mlen) ? 2+lz_extra(mext) : 0);
+  if (need > cap-pos)
+    return 0;
+  // Write the token, the literals and the match
+  unsigned char* out = dst+pos;
+  *out++ = (unsigned char)(MIN(nlits,LZ_NIBBLE)<<4|MIN(mext,LZ_NIBBLE));
+  out = lz_putlen(out,nlits);
+  memcpy(out,lits,nlits), out += nlits;
+  if (mlen) {
+    *out++ = (unsigned char)dist, *out++ = (unsigned char)(dist>>8);
+    out = lz_putlen(out,mext);
+  }
+  return (size_t)(out-dst);
+}
+
+//_____________________________________________________________________________
+
+// ------ FUNCTIONS ------ //
+
+size_t lz_compress(const unsigned char* src, const size_t len,
+unsigned char* dst, const size_t cap) {
+  // Start with every entry pointing to the beginning, checked on each use
+  uint32_t table[(size_t)1<<LZ_HASHBITS] = {0};
+  size_t i = 0, anchor = 0, pos = 0, misses = 0;
+  // Look for matches at the positions where a word can be read
+  while (len >= LZ_MINMATCH && i <= len-LZ_MINMATCH) {
+    uint32_t w = lz_load(src+i);
+    size_t h = lz_hash(w), ref = table[h];
+    table[h] = (uint32_t)i;
+    // Skip ahead faster the longer no match is found
+    if (ref >= i || i-ref > LZ_MAXDIST || lz_load(src+ref) != w) {
+      i += 1+(misses++>>LZ_SKIP);
+      continue;
+    }
+    // Extend the match backwards over the literals and then forwards
+    while (i > anchor && ref && src[i-1] == src[ref-1])
+      --i, --ref;
+    size_t mlen = LZ_MINMATCH;
+    while (i+mlen+8 <= len && lz_wide(src+ref+mlen) == lz_wide(src+i+mlen))
+      mlen += 8;
+    while (i+mlen < len && src[ref+mlen] == src[i+mlen])
+      ++mlen;
+    // Write the sequence and continue after the match
+    pos = lz_sequence(dst,pos,cap,src+anchor,i-anchor,i-ref,mlen);
+    if (!pos)
+      return 0;
+    i += mlen, anchor = i, misses = 0;
+  }
+  // Write the remaining literals
+  return lz_sequence(dst,pos,cap,src+anchor,len-anchor,0,0);
+}
+
+bool lz_decompress(const unsigned char* src, const size_t len,
+unsigned char* dst, const size_t size) {
+  // Decode the sequences until the block is over
+  size_t i = 0, pos = 0;
+  while (i < len) {
+    // Copy the literals
+    size_t token = src[i++], n = token>>4;
+    if ((n == LZ_NIBBLE && !lz_getlen(src,len,&i,&n)) || n > len-i ||
+    n > size-pos)
+      return false;
+    if (n <= 16 && len-i >= 16 && size-pos >= 16)
+      memcpy(dst+pos,src+i,16);
+    else
+      memcpy(dst+pos,src+i,n);
+    i += n, pos += n;
+    if (i == len)
+      break;
+    // Read the match, which must lie inside the output
+    if (len-i < 2)
+      return false;
+    size_t dist = (size_t)src[i]|(size_t)src[i+1]<<8, m = token&LZ_NIBBLE;
+    i += 2;
+    if ((m == LZ_NIBBLE && !lz_getlen(src,len,&i,&m)) || !dist ||
+    dist > pos || (m += LZ_MINMATCH) > size-pos)
+      return false;
+    // Copy it by blocks that do not overlap, overrunning it when there is
+    // room for that, or byte by byte otherwise
+    unsigned char* out = dst+pos;
+    const unsigned char* ref = out-dist;
+    size_t k = 0;
+    if (dist >= 16 && size-pos >= m+16)
+      for (; k < m; k += 16)
+        memcpy(out+k,ref+k,16);
+    else if (dist >= 8)
+      for (; k+8 <= m; k += 8)
+        memcpy(out+k,ref+k,8);
+    for (; k < m; ++k)
+      out[k] = ref[k];
+    pos += m;
+  }
+  // Return whether the whole output was filled
+  return pos == size;
+}
+
+//_____________________________________________________________________________
+
+#endif // __LZ_C__
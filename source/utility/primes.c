@@ -8,6 +8,101 @@
 // ------ INCLUDES ------ //
 
 #include "../../include/primes.h"
+#include <stdint.h>
+
+//_____________________________________________________________________________
+
+// ------ MACROS ------ //
+
+/** Number of small primes that divide the candidates before the test. */
+#ifndef PRIME_SMALL
+#define PRIME_SMALL 24
+#endif // PRIME_SMALL
+
+/** Number of bases of the test, which make it deterministic below 2^64. */
+#ifndef PRIME_BASES
+#define PRIME_BASES 7
+#endif // PRIME_BASES
+
+//_____________________________________________________________________________
+
+// ------ TYPES ------ //
+
+/** Unsigned 128-bit integer, for the products of the test. */
+__extension__ typedef unsigned __int128 PrimeWide;
+
+//_____________________________________________________________________________
+
+// ------ CONSTANTS ------ //
+
+/** Primes below 100 after 2, which sieve out most composites. */
+static const uint64_t smallprimes[PRIME_SMALL] = {
+  3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71,
+  73, 79, 83, 89, 97
+};
+
+/** Bases of the Miller-Rabin test found by Jim Sinclair, which no composite
+ * below 2^64 passes at once. */
+static const uint64_t primebases[PRIME_BASES] = {
+  2, 325, 9375, 28178, 450775, 9780504, 1795265022
+};
+
+//_____________________________________________________________________________
+
+// ------ STATICS ------ //
+
+/** Returns the inverse of the odd n modulo 2^64, by Newton's iteration,
+ * which doubles the correct bits from the 3 of n itself. */
+static inline uint64_t prime_inverse(const uint64_t n) {
+  // Refine the inverse five times
+  uint64_t inv = n;
+  for (int i = 0; i < 5; ++i)
+    inv *= 2-n*inv;
+  return inv;
+}
+
+/** Returns t/2^64 modulo the odd n given its inverse inv, by Montgomery
+ * reduction, for t below n*2^64. Subtracting the multiple of n that clears
+ * the lowest half never overflows, even for n above 2^63. */
+static inline uint64_t prime_redc(const PrimeWide t, const uint64_t n,
+const uint64_t inv) {
+  // Subtract the highest half of m*n, which matches t in the lowest one
+  uint64_t m = (uint64_t)t*inv, hi = (uint64_t)(t>>64);
+  uint64_t mn = (uint64_t)(((PrimeWide)m*n)>>64);
+  return (hi >= mn) ? hi-mn : hi-mn+n;
+}
+
+/** Returns a*b/2^64 modulo n, the product of the Montgomery forms a and
+ * b. */
+static inline uint64_t prime_mul(const uint64_t a, const uint64_t b,
+const uint64_t n, const uint64_t inv) {
+  // Reduce the full product
+  return prime_redc((PrimeWide)a*b,n,inv);
+}
+
+/** Checks whether the odd n above the small primes, with n-1 = d*2^s and
+ * d odd, passes the Miller-Rabin test of base a, working with the Montgomery
+ * forms of one, minus one and a. */
+static bool prime_witness(const uint64_t a, const uint64_t n,
+const uint64_t inv, const uint64_t r2, const uint64_t d, const int s) {
+  // Take the base into Montgomery form, skipping the multiples of n
+  uint64_t one = (uint64_t)((((PrimeWide)1)<<64)%n), minus = n-one;
+  uint64_t b = prime_mul(a%n,r2,n,inv), x = one;
+  if (!b)
+    return true;
+  // Raise it to d by squaring
+  for (uint64_t e = d; e; e >>= 1, b = prime_mul(b,b,n,inv))
+    if (e&1)
+      x = prime_mul(x,b,n,inv);
+  // Square it until it reaches minus one, which must happen before s times
+  // unless it was one already
+  if (x == one || x == minus)
+    return true;
+  for (int i = 1; i < s; ++i)
+    if ((x = prime_mul(x,x,n,inv)) == minus)
+      return true;
+  return false;
+}
 
 //_____________________________________________________________________________
 
@@ -15,17 +110,28 @@
 
 bool prime_check(const unsigned long long n) {
   // Check corner cases
-  if (n == 2 || n == 3)
-    return true;
-  if (n%2 == 0 || n%3 == 0 || n < 2)
+  if (n < 2)
     return false;
-  // Check primality by trial division
-  bool prime = true;
-  unsigned long long i = 5, ii = 25, last = 0;
-  while (ii <= n && ii > last && prime)
-    prime = !(n%i == 0 || n%(i+2) == 0), last = ii, ii += 12*i+36, i += 6;
+  if (n%2 == 0)
+    return n == 2;
+  // Check divisibility by the small primes, which settle every n below the
+  // square of the next one
+  for (int i = 0; i < PRIME_SMALL; ++i)
+    if (n%smallprimes[i] == 0)
+      return n == smallprimes[i];
+  if (n < 101*101)
+    return true;
+  // Check primality by the Miller-Rabin test with every base
+  uint64_t d = n-1, inv = prime_inverse(n);
+  uint64_t r2 = (uint64_t)((PrimeWide)(-(uint64_t)n%n)*(-(uint64_t)n%n)%n);
+  int s = 0;
+  for (; !(d&1); d >>= 1)
+    ++s;
+  for (int i = 0; i < PRIME_BASES; ++i)
+    if (!prime_witness(primebases[i],n,inv,r2,d,s))
+      return false;
   // Return answer
-  return prime;
+  return true;
 }
 
 unsigned long long prime_next(const unsigned long long n) {
@@ -38,7 +144,7 @@ unsigned long long prime_next(const unsigned long long n) {
   unsigned long long i = m%6;
   if (i == 0 && ++i && prime_check(++m))
     return m;
-  // Find next prime by trial division, ignoring multiples of 2 and 3
+  // Find next prime, ignoring multiples of 2 and 3
   if (i < 5)
     m += 5-i;
   bool found = false, overflow = m < n;
@@ -1,5 +1,6 @@
 /// SOURCE - RANDOM
-/** Source file for a 32-bit Mersenne Twister pseudorandom generator. */
+/** Source file for Mersenne Twister, xoshiro256** and PCG64 pseudorandom
+ * generators and an AES-CTR cryptographically secure one. */
 #ifndef __RANDOM_C__
 #define __RANDOM_C__
 
@@ -7,16 +8,39 @@
 
 // ------ INCLUDES ------ //
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif // _POSIX_C_SOURCE
+
 #include "../../include/random.h"
+#include "../../include/aesctr.h"
 #include <time.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/random.h>
+#endif // __linux__
 
 //_____________________________________________________________________________
 
 // ------ MACROS ------ //
 
-/* Degree of recurrence. */
+/** Whether the vector extensions of x86 processors can be used. */
+#ifndef RANDOM_X86
+#if defined(__x86_64__) || defined(__i386__)
+#define RANDOM_X86 1
+#else
+#define RANDOM_X86 0
+#endif // __x86_64__ || __i386__
+#endif // RANDOM_X86
+
+/** Degree of recurrence. */
 #ifndef N
-#define N ((size_t)624)
+#define N RANDOM_N
 #endif // N
 
 /** Offset used in the recurrence. */
@@ -34,58 +58,1091 @@
 #define LM ((uint32_t)0x7fffffff)
 #endif // LM
 
+/** Twist matrix of the recurrence. */
+#ifndef MA
+#define MA ((uint32_t)0x9908b0df)
+#endif // MA
+
+/** Degree of the characteristic polynomial of the recurrence, which is the
+ * number of bits of its state. */
+#ifndef RANDOM_DEGREE
+#define RANDOM_DEGREE ((size_t)19937)
+#endif // RANDOM_DEGREE
+
+/** Number of 64-bit words of a polynomial of lower degree. */
+#ifndef RANDOM_WORDS
+#define RANDOM_WORDS ((RANDOM_DEGREE+63)/64)
+#endif // RANDOM_WORDS
+
+/** Number of terms of the characteristic polynomial below its degree. */
+#ifndef RANDOM_TERMS
+#define RANDOM_TERMS ((size_t)134)
+#endif // RANDOM_TERMS
+
+/** Lowest 256 bits of the characteristic polynomial of xoshiro256**, whose
+ * degree is 256, lowest word first. */
+#ifndef RANDOM_XOPOLY
+#define RANDOM_XOPOLY \
+  {0x9d116f2bb0f0f001, 0x0280002bcefd1a5e, 0x04b4edcf26259f85, \
+  0x0003c03c3f3ecb19}
+#endif // RANDOM_XOPOLY
+
+/** Multiplier of the congruence of PCG64. */
+#ifndef RANDOM_PCGMUL
+#define RANDOM_PCGMUL \
+  ((RandomWide)0x2360ed051fc65da4<<64|0x4385df649fccf645)
+#endif // RANDOM_PCGMUL
+
+/** Number of bounded numbers drawn and scaled at once by the batched
+ * variants, which stay in the cache meanwhile. */
+#ifndef RANDOM_CHUNK
+#define RANDOM_CHUNK ((size_t)1024)
+#endif // RANDOM_CHUNK
+
+/** Number of layers of the ziggurats of the normal and the exponential
+ * distributions, powers of 2 whose bits choose the layer. */
+#ifndef RANDOM_NLAYERS
+#define RANDOM_NLAYERS ((size_t)128)
+#endif // RANDOM_NLAYERS
+#ifndef RANDOM_ELAYERS
+#define RANDOM_ELAYERS ((size_t)256)
+#endif // RANDOM_ELAYERS
+
+/** Start of the tail and area of each layer of the ziggurat of the normal
+ * distribution, as found by Marsaglia and Tsang. */
+#ifndef RANDOM_NTAIL
+#define RANDOM_NTAIL 3.442619855899
+#endif // RANDOM_NTAIL
+#ifndef RANDOM_NAREA
+#define RANDOM_NAREA 9.91256303526217e-3
+#endif // RANDOM_NAREA
+
+/** Start of the tail and area of each layer of the ziggurat of the
+ * exponential distribution. */
+#ifndef RANDOM_ETAIL
+#define RANDOM_ETAIL 7.697117470131487
+#endif // RANDOM_ETAIL
+#ifndef RANDOM_EAREA
+#define RANDOM_EAREA 3.949659822581572e-3
+#endif // RANDOM_EAREA
+
+/** Bytes of secure output after which the key is drawn again from the
+ * system. */
+#ifndef RANDOM_RESEED
+#define RANDOM_RESEED ((size_t)1<<20)
+#endif // RANDOM_RESEED
+
+/** Number of counter blocks encrypted at once by the secure generator. */
+#ifndef RANDOM_BATCH
+#define RANDOM_BATCH ((size_t)256)
+#endif // RANDOM_BATCH
+
+/** Source of the keys of the secure generator where getrandom is not
+ * available. */
+#ifndef RANDOM_DEVICE
+#define RANDOM_DEVICE "/dev/urandom"
+#endif // RANDOM_DEVICE
+
+//_____________________________________________________________________________
+
+// ------ TYPES ------ //
+
+/** Unsigned 128-bit integer, for the state of PCG64. */
+__extension__ typedef unsigned __int128 RandomWide;
+
 //_____________________________________________________________________________
 
 // ------ VARIABLES ------ //
 
-/** Array of state vector. */
-static uint32_t mt[N];
+/** Default generator, unseeded until it is first used. */
+static struct _Random rnddefault;
+
+/** Whether the default generator was seeded. */
+static bool rndseeded = false;
+
+/** Exponents of the terms of the characteristic polynomial of the
+ * recurrence below its degree, found by the Berlekamp-Massey algorithm. */
+static const uint16_t rndterms[RANDOM_TERMS] = {
+  0, 1189, 1416, 1585, 1643, 1870, 2493, 2773, 3000, 3227, 3454, 3681, 3908,
+  4135, 4362, 4753, 5661, 6337, 6569, 7129, 7477, 7525, 7583, 7752, 7979, 8206,
+  9505, 9901, 9969, 10128, 10693, 10761, 10920, 11089, 11147, 11157, 11215,
+  11321, 11374, 11384, 11485, 11611, 11712, 11717, 11838, 11881, 11944, 11997,
+  12277, 12335, 12393, 12504, 12509, 12620, 12673, 12731, 12736, 12789, 12905,
+  12958, 12963, 13137, 13185, 13190, 13243, 13301, 13412, 13528, 13533, 13639,
+  13697, 13760, 13813, 13866, 14093, 14151, 14209, 14320, 14325, 14436, 14547,
+  14552, 14605, 14721, 14774, 14779, 14953, 15001, 15006, 15059, 15117, 15228,
+  15344, 15349, 15455, 15513, 15576, 15629, 15682, 15909, 15967, 16025, 16136,
+  16141, 16252, 16363, 16368, 16421, 16537, 16590, 16595, 16817, 16822, 16875,
+  16933, 17044, 17160, 17271, 17329, 17445, 17498, 17725, 17783, 17841, 17952,
+  18068, 18179, 18237, 18406, 18633, 18691, 18860, 19087, 19314
+};
+
+/** Polynomial of the last jump, x^(2^e) modulo the characteristic one, and
+ * its exponent e, or UINT_MAX if there was none. */
+static uint64_t rndpower[RANDOM_WORDS];
+static unsigned rndexponent = UINT_MAX;
+
+/** Guard of the polynomial of the last jump. */
+static pthread_mutex_t rndjumplock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Right edges of the layers of the ziggurat of the normal distribution,
+ * the first one being the width of a rectangle of the same area as the base
+ * with its tail, the ratios of the next edge to each one and the density at
+ * each edge. */
+static double rndnx[RANDOM_NLAYERS+1], rndnr[RANDOM_NLAYERS];
+static double rndnf[RANDOM_NLAYERS+1];
+
+/** Right edges, ratios and densities of the ziggurat of the exponential
+ * distribution. */
+static double rndex[RANDOM_ELAYERS+1], rnder[RANDOM_ELAYERS];
+static double rndef[RANDOM_ELAYERS+1];
+
+/** Guard that builds the ziggurats once. */
+static pthread_once_t rndzigonce = PTHREAD_ONCE_INIT;
+
+/** Block cipher of the secure generator. */
+static struct _Aes rndaes;
+
+/** Bytes of secure output since the key was drawn from the system. */
+static size_t rndbytes = 0;
+
+/** Whether the secure generator has a key. */
+static bool rndready = false;
+
+/** Whether the key must be drawn from the system before the next bytes. */
+static bool rndstale = true;
+
+/** Whether the handlers that guard the secure generator across forks are
+ * registered. */
+static bool rndhooked = false;
+
+/** Guard of the secure generator. */
+static pthread_mutex_t rndlock = PTHREAD_MUTEX_INITIALIZER;
+
+//_____________________________________________________________________________
+
+// ------ STATICS ------ //
+
+/** Returns the next word of the state vector given the word to replace, the
+ * one after it and the one M places after it, without branches nor tables so
+ * that the loops over the state are vectorized. */
+static inline uint32_t random_mix(const uint32_t w, const uint32_t next,
+const uint32_t far) {
+  // Join the high bit and the low bits and apply the matrix
+  uint32_t y = (w&UM)|(next&LM);
+  return far^(y>>1)^((uint32_t)-(y&1)&MA);
+}
+
+/** Tempers the word y of the state vector. */
+static inline uint32_t random_temper(uint32_t y) {
+  // Shift and mask it
+  y ^= (y>>11), y ^= (y<<7)&0x9d2c5680, y ^= (y<<15)&0xefc60000;
+  return y^(y>>18);
+}
+
+/** Regenerates the whole state vector of rng. The second loop reads the
+ * words written M-N places before, far enough behind for any vector
+ * width. */
+__attribute__((always_inline))
+static inline void random_twist(Random rng) {
+  // Modify the state vector accordingly
+  uint32_t* mt = rng->mt;
+  for (size_t i = 0; i < N-M; ++i)
+    mt[i] = random_mix(mt[i],mt[i+1],mt[i+M]);
+  for (size_t i = N-M; i < N-1; ++i)
+    mt[i] = random_mix(mt[i],mt[i+1],mt[i-(N-M)]);
+  mt[N-1] = random_mix(mt[N-1],mt[0],mt[M-1]);
+  rng->mti = 0;
+}
+
+/** Writes into buf the next n tempered words of rng, regenerating its state
+ * vector whenever it runs out. */
+__attribute__((always_inline))
+static inline void random_draw(Random rng, uint32_t* buf, size_t n) {
+  // Temper the state a whole vector at a time
+  while (n) {
+    if (rng->mti >= N)
+      random_twist(rng);
+    size_t k = MIN(n,N-rng->mti);
+    const uint32_t* mt = rng->mt+rng->mti;
+    for (size_t i = 0; i < k; ++i)
+      buf[i] = random_temper(mt[i]);
+    buf += k, n -= k, rng->mti += k;
+  }
+}
+
+#if RANDOM_X86
+
+/** Writes into buf the next n words of rng with AVX2 operations. */
+__attribute__((target("avx2")))
+static void random_drawwide(Random rng, uint32_t* buf, const size_t n) {
+  // Draw the words with 256-bit registers
+  random_draw(rng,buf,n);
+}
+
+#endif // RANDOM_X86
+
+/** Writes into buf the next n words of rng with the baseline vector
+ * registers, which are SSE2 ones on x86-64. */
+static void random_drawnarrow(Random rng, uint32_t* buf, const size_t n) {
+  // Draw the words with the default registers
+  random_draw(rng,buf,n);
+}
+
+/** Regenerates the whole state vector of rng out of line, so that the code
+ * that takes one word at a time stays small where it is inlined. */
+__attribute__((noinline,cold))
+static void random_refresh(Random rng) {
+  // Modify the state vector with the default registers
+  random_twist(rng);
+}
+
+/** Generates the next tempered word of the Mersenne Twister rng. */
+static inline uint32_t random_mt(Random rng) {
+  // Generate N words when the state vector runs out
+  if (rng->mti >= N)
+    random_refresh(rng);
+  // Return the tempered value
+  return random_temper(rng->mt[rng->mti++]);
+}
+
+/** Rotates the word x left by k bits. */
+static inline uint64_t random_rotl(const uint64_t x, const unsigned k) {
+  // Join both shifts
+  return (x<<k)|(x>>((64-k)&63));
+}
+
+/** Returns the next number of SplitMix64 from the counter x. */
+static inline uint64_t random_splitmix(uint64_t* x) {
+  // Mix the next value of the counter
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+  z = (z^(z>>30))*0xbf58476d1ce4e5b9, z = (z^(z>>27))*0x94d049bb133111eb;
+  return z^(z>>31);
+}
+
+/** Steps the state s of xoshiro256** and returns its number. */
+static inline uint64_t random_xoshiro(uint64_t s[4]) {
+  // Scramble the second word and shift the linear state
+  uint64_t out = random_rotl(s[1]*5,7)*9, t = s[1]<<17;
+  s[2] ^= s[0], s[3] ^= s[1], s[1] ^= s[2], s[0] ^= s[3], s[2] ^= t;
+  s[3] = random_rotl(s[3],45);
+  return out;
+}
+
+/** Joins the halves h of a 128-bit integer, highest first. */
+static inline RandomWide random_wide(const uint64_t h[2]) {
+  // Shift the highest one
+  return (RandomWide)h[0]<<64|h[1];
+}
+
+/** Splits the 128-bit integer w into halves h, highest first. */
+static inline void random_halves(uint64_t h[2], const RandomWide w) {
+  // Truncate both shifts
+  h[0] = (uint64_t)(w>>64), h[1] = (uint64_t)w;
+}
+
+/** Steps the state s of PCG64 with increment inc and returns its number,
+ * the xor of its halves rotated by its 6 highest bits. */
+static inline uint64_t random_pcg(RandomWide* s, const RandomWide inc) {
+  // Advance the congruence and permute the new state
+  *s = *s*RANDOM_PCGMUL+inc;
+  uint64_t x = (uint64_t)(*s>>64)^(uint64_t)*s;
+  unsigned r = (unsigned)(*s>>122);
+  return (x>>r)|(x<<((64-r)&63));
+}
+
+/** Seeds the PCG64 rng with the given initial state and stream, like the
+ * reference implementation. */
+static void random_pcgseed(Random rng, const RandomWide init,
+const RandomWide seq) {
+  // Step from zero, add the initial state and step again
+  RandomWide s = 0, inc = seq<<1|1;
+  random_pcg(&s,inc), s += init, random_pcg(&s,inc);
+  random_halves(rng->state,s), random_halves(rng->inc,inc);
+}
+
+/** Stores the number x of a 64-bit generator at position i of buf, whose
+ * elements are of the given bits, 32 or 64, or 0 for reals, keeping the
+ * highest bits of x. */
+static inline void random_put(void* buf, const size_t i, const uint64_t x,
+const int bits) {
+  // Convert the number to the type of the buffer
+  if (bits == 32)
+    ((uint32_t*)buf)[i] = (uint32_t)(x>>32);
+  else if (bits == 64)
+    ((uint64_t*)buf)[i] = x;
+  else
+    ((double*)buf)[i] = (double)(x>>11)*(1./9007199254740992.);
+}
+
+/** Writes into buf, whose elements are of the given bits, n numbers of the
+ * 64-bit generator rng, keeping its state in locals meanwhile. */
+__attribute__((always_inline))
+static inline void random_run(Random rng, void* buf, const size_t n,
+const int bits) {
+  // Step the state of the algorithm of the generator
+  if (rng->kind == RANDOM_XOSHIRO) {
+    uint64_t s[4];
+    memcpy(s,rng->xs,sizeof(s));
+    for (size_t i = 0; i < n; ++i)
+      random_put(buf,i,random_xoshiro(s),bits);
+    memcpy(rng->xs,s,sizeof(s));
+  } else {
+    RandomWide s = random_wide(rng->state), inc = random_wide(rng->inc);
+    for (size_t i = 0; i < n; ++i)
+      random_put(buf,i,random_pcg(&s,inc),bits);
+    random_halves(rng->state,s);
+  }
+}
+
+/** Generates the next 64-bit number of rng, made of two words of the
+ * Mersenne Twister. */
+static inline uint64_t random_step64(Random rng) {
+  // Step the state of the algorithm of the generator
+  switch (rng->kind) {
+    case RANDOM_XOSHIRO:
+      return random_xoshiro(rng->xs);
+    case RANDOM_PCG: {
+      RandomWide s = random_wide(rng->state);
+      uint64_t x = random_pcg(&s,random_wide(rng->inc));
+      random_halves(rng->state,s);
+      return x;
+    }
+    default: {
+      uint64_t hi = random_mt(rng);
+      return hi<<32|random_mt(rng);
+    }
+  }
+}
+
+/** Generates the next 32-bit number of rng, the highest half of a number of
+ * the 64-bit generators. */
+static inline uint32_t random_step(Random rng) {
+  // Keep the highest half of a number or temper a word
+  switch (rng->kind) {
+    case RANDOM_XOSHIRO:
+      return (uint32_t)(random_xoshiro(rng->xs)>>32);
+    case RANDOM_PCG:
+      return (uint32_t)(random_step64(rng)>>32);
+    default:
+      return random_mt(rng);
+  }
+}
+
+/** Draws 32-bit numbers of rng until the lowest half of their product by
+ * bound is not below the threshold where the range would be biased, given
+ * the product m of the first one, whose lowest half is below bound. Returns
+ * the product accepted. */
+__attribute__((noinline))
+static uint64_t random_reject(Random rng, uint64_t m, const uint32_t bound) {
+  // Find the threshold, 2^32 modulo bound, and draw again below it
+  uint32_t t = (uint32_t)-bound%bound;
+  while ((uint32_t)m < t)
+    m = (uint64_t)random_step(rng)*bound;
+  return m;
+}
+
+/** Draws 64-bit numbers of rng like random_reject. */
+__attribute__((noinline))
+static RandomWide random_reject64(Random rng, RandomWide m,
+const uint64_t bound) {
+  // Find the threshold, 2^64 modulo bound, and draw again below it
+  uint64_t t = -bound%bound;
+  while ((uint64_t)m < t)
+    m = (RandomWide)random_step64(rng)*bound;
+  return m;
+}
+
+/** Returns rng, or the default generator if it is NULL, seeding it from the
+ * time if it was not. */
+static inline Random random_resolve(Random rng) {
+  // Seed the default generator once
+  if (rng)
+    return rng;
+  if (!rndseeded)
+    random_seed((uint32_t)time(NULL));
+  return &rnddefault;
+}
+
+/** Scales the k numbers of b into the range [0,bound) unless any of them is
+ * below the threshold t where it would be biased. Returns whether none is. */
+__attribute__((always_inline))
+static inline bool random_scale(uint32_t* b, const size_t k,
+const uint32_t bound, const uint32_t t) {
+  // Check the lowest halves of the products and then keep the highest ones
+  uint32_t biased = 0;
+  for (size_t j = 0; j < k; ++j)
+    biased |= (uint32_t)(b[j]*bound < t);
+  if (biased)
+    return false;
+  for (size_t j = 0; j < k; ++j)
+    b[j] = (uint32_t)((uint64_t)b[j]*bound>>32);
+  return true;
+}
+
+#if RANDOM_X86
+
+/** Scales the k numbers of b into the range with AVX2 operations. */
+__attribute__((target("avx2")))
+static bool random_scalewide(uint32_t* b, const size_t k,
+const uint32_t bound, const uint32_t t) {
+  // Scale the numbers with 256-bit registers
+  return random_scale(b,k,bound,t);
+}
+
+#endif // RANDOM_X86
+
+/** Scales the k numbers of b into the range with the baseline vector
+ * registers. */
+static bool random_scalenarrow(uint32_t* b, const size_t k,
+const uint32_t bound, const uint32_t t) {
+  // Scale the numbers with the default registers
+  return random_scale(b,k,bound,t);
+}
+
+/** Converts the 53 highest bits of x to a real on range [0,1). */
+static inline double random_real53(const uint64_t x) {
+  // Scale the integer
+  return (double)(x>>11)*(1./9007199254740992.);
+}
+
+/** Generates a random real on range [0,1) with rng. */
+static inline double random_double(Random rng) {
+  // Join the highest bits of two words of the Mersenne Twister as before
+  if (rng->kind != RANDOM_MT)
+    return random_real53(random_step64(rng));
+  uint64_t a = random_mt(rng)>>5, b = random_mt(rng)>>6;
+  return (double)(a<<26|b)*(1./9007199254740992.);
+}
+
+/** Builds the layers of the ziggurats from the tail and the area of each
+ * layer, each edge being where the density reaches the area over the
+ * previous edge plus the density there. */
+static void random_zigset(void) {
+  // Stack the layers of the normal distribution up to 0
+  rndnx[0] = RANDOM_NAREA/exp(-.5*RANDOM_NTAIL*RANDOM_NTAIL);
+  rndnx[1] = RANDOM_NTAIL, rndnx[RANDOM_NLAYERS] = 0;
+  for (size_t i = 1; i+1 < RANDOM_NLAYERS; ++i)
+    rndnx[i+1] = sqrt(-2*log(RANDOM_NAREA/rndnx[i]+
+    exp(-.5*rndnx[i]*rndnx[i])));
+  for (size_t i = 0; i <= RANDOM_NLAYERS; ++i)
+    rndnf[i] = exp(-.5*rndnx[i]*rndnx[i]);
+  for (size_t i = 0; i < RANDOM_NLAYERS; ++i)
+    rndnr[i] = rndnx[i+1]/rndnx[i];
+  // Stack the layers of the exponential distribution
+  rndex[0] = RANDOM_EAREA/exp(-RANDOM_ETAIL);
+  rndex[1] = RANDOM_ETAIL, rndex[RANDOM_ELAYERS] = 0;
+  for (size_t i = 1; i+1 < RANDOM_ELAYERS; ++i)
+    rndex[i+1] = -log(RANDOM_EAREA/rndex[i]+exp(-rndex[i]));
+  for (size_t i = 0; i <= RANDOM_ELAYERS; ++i)
+    rndef[i] = exp(-rndex[i]);
+  for (size_t i = 0; i < RANDOM_ELAYERS; ++i)
+    rnder[i] = rndex[i+1]/rndex[i];
+}
+
+/** Converts the 53 highest bits of x to a real on range [-1,1). */
+static inline double random_signed53(const uint64_t x) {
+  // Scale the integer to twice the range and center it
+  return (double)(x>>11)*(1./4503599627370496.)-1;
+}
+
+/** Returns a real of the standard normal distribution of rng given the
+ * 64-bit number x, which did not fall inside its rectangle, drawing more
+ * numbers until one falls under the density. */
+__attribute__((noinline))
+static double random_gauss(Random rng, uint64_t x) {
+  // Take the layer from the lowest bits
+  for (;; x = random_step64(rng)) {
+    size_t i = x&(RANDOM_NLAYERS-1);
+    double u = random_signed53(x), z = u*rndnx[i];
+    if (fabs(u) < rndnr[i])
+      return z;
+    // Sample the tail beyond the base by Marsaglia's method
+    if (!i) {
+      double a, b;
+      do
+        a = -log(1-random_double(rng))/RANDOM_NTAIL,
+        b = -log(1-random_double(rng));
+      while (b+b < a*a);
+      return (u < 0) ? -RANDOM_NTAIL-a : RANDOM_NTAIL+a;
+    }
+    // Accept the point of the wedge if it lies under the density
+    if (rndnf[i]+random_double(rng)*(rndnf[i+1]-rndnf[i]) < exp(-.5*z*z))
+      return z;
+  }
+}
+
+/** Returns a real of the exponential distribution of rng given the 64-bit
+ * number x, which did not fall inside its rectangle, like random_gauss. */
+__attribute__((noinline))
+static double random_expo(Random rng, uint64_t x) {
+  // Take the layer from the lowest bits
+  for (;; x = random_step64(rng)) {
+    size_t i = x&(RANDOM_ELAYERS-1);
+    double u = random_real53(x), z = u*rndex[i];
+    if (u < rnder[i])
+      return z;
+    // Add an exponential to the start of the tail, which has no memory
+    if (!i)
+      return RANDOM_ETAIL-log(1-random_double(rng));
+    if (rndef[i]+random_double(rng)*(rndef[i+1]-rndef[i]) < exp(-z))
+      return z;
+  }
+}
+
+/** Returns a real of the standard normal distribution of rng given the
+ * 64-bit number x, inside its rectangle in nearly every case. */
+static inline double random_zignormal(Random rng, const uint64_t x) {
+  // Scale the signed position by the width of the layer and keep it if
+  // inside
+  size_t i = x&(RANDOM_NLAYERS-1);
+  double u = random_signed53(x);
+  if (fabs(u) >= rndnr[i])
+    return random_gauss(rng,x);
+  return u*rndnx[i];
+}
+
+/** Returns a real of the exponential distribution of rng given the 64-bit
+ * number x, inside its rectangle in nearly every case. */
+static inline double random_zigexp(Random rng, const uint64_t x) {
+  // Scale the position by the width of the layer and keep it if inside
+  size_t i = x&(RANDOM_ELAYERS-1);
+  double u = random_real53(x);
+  if (u >= rnder[i])
+    return random_expo(rng,x);
+  return u*rndex[i];
+}
+
+/** Rewrites the state vector of rng as the next N words of the recurrence,
+ * from the one of the next number on, with its index at 0, which describes
+ * the same stream and moves along it as the polynomial variable. */
+static void random_align(Random rng) {
+  // Regenerate the state vector if it ran out
+  if (rng->mti >= N)
+    random_twist(rng);
+  // Extend the recurrence over the words already used, one at a time
+  uint32_t *mt = rng->mt, w[N];
+  size_t used = rng->mti;
+  for (size_t i = 0; i < used; ++i)
+    mt[i] = random_mix(mt[i],mt[i+1],mt[(i+M)%N]);
+  // Rotate the window to the front
+  memcpy(w,mt+used,(N-used)*sizeof(*w)), memcpy(w+N-used,mt,used*sizeof(*w));
+  memcpy(mt,w,sizeof(w)), rng->mti = 0;
+}
+
+/** Spreads the bits of x over the even bits of a 64-bit word. */
+static inline uint64_t random_spread(const uint32_t x) {
+  // Interleave zeros with halves of decreasing size
+  uint64_t y = x;
+  y = (y|y<<16)&0x0000ffff0000ffff, y = (y|y<<8)&0x00ff00ff00ff00ff;
+  y = (y|y<<4)&0x0f0f0f0f0f0f0f0f, y = (y|y<<2)&0x3333333333333333;
+  return (y|y<<1)&0x5555555555555555;
+}
+
+/** Squares the polynomial p over GF(2) modulo the characteristic polynomial
+ * of the recurrence of the Mersenne Twister. */
+static void random_square(uint64_t p[RANDOM_WORDS]) {
+  // Spread the bits, since the square of a sum has no cross terms
+  uint64_t q[2*RANDOM_WORDS];
+  for (size_t i = 0; i < RANDOM_WORDS; ++i)
+    q[2*i] = random_spread((uint32_t)p[i]),
+    q[2*i+1] = random_spread((uint32_t)(p[i]>>32));
+  // Replace x^d by the lower terms from the highest word down, which never
+  // reach the word being reduced since the next term is 623 degrees lower
+  for (size_t j = 2*RANDOM_WORDS-1; j >= RANDOM_DEGREE/64; --j) {
+    size_t base = MAX(64*j,RANDOM_DEGREE);
+    uint64_t c = q[j]>>(base-64*j);
+    q[j] ^= c<<(base-64*j);
+    for (size_t t = 0; c && t < RANDOM_TERMS; ++t) {
+      size_t at = base-RANDOM_DEGREE+rndterms[t];
+      q[at/64] ^= c<<(at%64);
+      if (at%64)
+        q[at/64+1] ^= c>>(64-at%64);
+    }
+  }
+  memcpy(p,q,RANDOM_WORDS*sizeof(*p));
+}
+
+/** Moves the Mersenne Twister rng 2^e steps ahead, evaluating x^(2^e) modulo
+ * the characteristic polynomial of its recurrence at its state by Horner's
+ * rule, in about as many steps as bits in the state. The polynomial of the
+ * last e is kept, so that only a new e takes time linear in it. */
+static void random_mtjump(Random rng, const unsigned e) {
+  // Compute x^(2^e) modulo the characteristic polynomial by squaring x,
+  // unless the last jump had the same length
+  uint64_t p[RANDOM_WORDS] = {2};
+  pthread_mutex_lock(&rndjumplock);
+  if (rndexponent != e) {
+    for (unsigned i = 0; i < e; ++i)
+      random_square(p);
+    memcpy(rndpower,p,sizeof(p)), rndexponent = e;
+  }
+  memcpy(p,rndpower,sizeof(p));
+  pthread_mutex_unlock(&rndjumplock);
+  // Evaluate it at the window of the recurrence by Horner's rule, stepping
+  // the sum as a circular buffer that starts at r
+  random_align(rng);
+  uint32_t *mt = rng->mt, sum[N] = {0};
+  size_t r = 0;
+  for (size_t i = RANDOM_DEGREE; i--;) {
+    sum[r] = random_mix(sum[r],sum[(r+1)%N],sum[(r+M)%N]), r = (r+1)%N;
+    if (!(p[i/64]>>(i%64)&1))
+      continue;
+    for (size_t k = 0; k < N-r; ++k)
+      sum[r+k] ^= mt[k];
+    for (size_t k = N-r; k < N; ++k)
+      sum[k-(N-r)] ^= mt[k];
+  }
+  // Store the window reached with its first word at the front
+  memcpy(mt,sum+r,(N-r)*sizeof(*mt)), memcpy(mt+N-r,sum,r*sizeof(*mt));
+}
+
+/** Moves the state s of xoshiro256** 2^e steps ahead, adding the states
+ * reached at the terms of x^(2^e) modulo the characteristic polynomial of its
+ * recurrence. */
+static void random_xojump(uint64_t s[4], const unsigned e) {
+  // Compute x^(2^e) modulo the characteristic polynomial by squaring x,
+  // replacing x^k by the lower terms bit by bit, which lie 15 or more
+  // degrees below it
+  const uint64_t g[4] = RANDOM_XOPOLY;
+  uint64_t p[4] = {2, 0, 0, 0}, q[8];
+  for (unsigned i = 0; i < e; ++i) {
+    for (size_t j = 0; j < 4; ++j)
+      q[2*j] = random_spread((uint32_t)p[j]),
+      q[2*j+1] = random_spread((uint32_t)(p[j]>>32));
+    for (size_t k = 511; k >= 256; --k) {
+      if (!(q[k/64]>>(k%64)&1))
+        continue;
+      size_t d = k-256;
+      q[k/64] ^= (uint64_t)1<<(k%64);
+      for (size_t j = 0; j < 4; ++j) {
+        q[j+d/64] ^= g[j]<<(d%64);
+        if (d%64)
+          q[j+d/64+1] ^= g[j]>>(64-d%64);
+      }
+    }
+    memcpy(p,q,sizeof(p));
+  }
+  // Add the states where its terms are set
+  uint64_t t[4] = {0, 0, 0, 0};
+  for (size_t k = 0; k < 256; ++k) {
+    if (p[k/64]>>(k%64)&1)
+      for (size_t j = 0; j < 4; ++j)
+        t[j] ^= s[j];
+    random_xoshiro(s);
+  }
+  memcpy(s,t,sizeof(t));
+}
+
+/** Moves the PCG64 rng 2^e steps ahead, composing the affine map of its step
+ * with itself e times. It returns to the same state for e of 128 or more, its
+ * period being 2^128. */
+static void random_pcgjump(Random rng, const unsigned e) {
+  // Square the map x -> a*x+c, which wraps after 128 times
+  RandomWide a = RANDOM_PCGMUL, c = random_wide(rng->inc);
+  if (e >= 128)
+    return;
+  for (unsigned i = 0; i < e; ++i)
+    c *= a+1, a *= a;
+  random_halves(rng->state,a*random_wide(rng->state)+c);
+}
+
+/** Takes the guard of the secure generator, before a fork too. */
+static void random_lock(void) {
+  // Lock the mutex
+  pthread_mutex_lock(&rndlock);
+}
+
+/** Releases the guard of the secure generator, after a fork too. */
+static void random_unlock(void) {
+  // Unlock the mutex
+  pthread_mutex_unlock(&rndlock);
+}
+
+/** Releases the guard of the secure generator in the child of a fork,
+ * which must not repeat the bytes of its parent. */
+static void random_forked(void) {
+  // Force a new key and unlock the mutex
+  rndstale = true;
+  pthread_mutex_unlock(&rndlock);
+}
+
+/** Reads len bytes of entropy from the system into buf. Returns whether
+ * they were read. */
+static bool random_entropy(unsigned char* buf, const size_t len) {
+#if defined(__linux__)
+  // Ask the kernel, retrying if interrupted
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = getrandom(buf+done,len-done,0);
+    if (n < 0 && errno != EINTR)
+      return false;
+    done += (n > 0) ? (size_t)n : 0;
+  }
+  return true;
+#else
+  // Read the random device
+  FILE* src = fopen(RANDOM_DEVICE,"rb");
+  bool valid = src && fread(buf,1,len,src) == len;
+  if (src)
+    fclose(src);
+  return valid;
+#endif // __linux__
+}
 
-/** Index of state vector. */
-static size_t mti = N+1;
+/** Writes into out len bytes of the keystream of the secure generator from
+ * the given block on, encrypting the counter blocks in place. */
+static void random_stream(unsigned char* out, const size_t len,
+unsigned long long block) {
+  // Encrypt batches of whole blocks where they go
+  size_t full = len/16;
+  for (size_t i = 0; i < full; i += RANDOM_BATCH) {
+    size_t n = MIN(RANDOM_BATCH,full-i);
+    for (size_t j = 0; j < n; ++j, ++block) {
+      memset(out+16*(i+j),0,8);
+      for (int b = 0; b < 8; ++b)
+        out[16*(i+j)+8+(size_t)b] = (unsigned char)(block>>(56-8*b));
+    }
+    aes_encrypt(&rndaes,out+16*i,n);
+  }
+  // Encrypt the last partial block apart and wipe what is left of it
+  if (len%16) {
+    unsigned char ks[16] = {0};
+    volatile unsigned char* k = ks;
+    for (int b = 0; b < 8; ++b)
+      ks[8+b] = (unsigned char)(block>>(56-8*b));
+    aes_encrypt(&rndaes,ks,1);
+    memcpy(out+16*full,ks,len%16);
+    for (size_t i = 0; i < sizeof(ks); ++i)
+      k[i] = 0;
+  }
+}
+
+/** Replaces the key of the secure generator with the first two blocks of
+ * its keystream, which are never output, xored with new entropy from the
+ * system if reseed is true. Returns whether the entropy was read. */
+static bool random_rekey(const bool reseed) {
+  // Gather the keystream and the entropy
+  unsigned char key[32] = {0}, seed[32] = {0};
+  if (reseed && !random_entropy(seed,sizeof(seed)))
+    return false;
+  if (rndready)
+    random_stream(key,sizeof(key),0);
+  // Expand the new key and wipe both
+  for (size_t i = 0; i < sizeof(key); ++i)
+    key[i] ^= seed[i];
+  aes_init(&rndaes,key,AES_256), rndready = true;
+  volatile unsigned char *k = key, *e = seed;
+  for (size_t i = 0; i < sizeof(key); ++i)
+    k[i] = e[i] = 0;
+  return true;
+}
 
 //_____________________________________________________________________________
 
 // ------ FUNCTIONS ------ //
 
 void random_seed(const uint32_t seed) {
-  // Initialize the state vector
-  mt[0] = seed;
-  for (mti = 1; mti < N; ++mti)
-    mt[mti] = 1812433253*(mt[mti-1]^(mt[mti-1]>>30))+(uint32_t)mti;
+  // Seed the default generator
+  random_init(&rnddefault,seed), rndseeded = true;
 }
 
 uint32_t random_int(void) {
-  // Initialize values
-  uint32_t y;
-  static uint32_t mat[2] = {0, 0x9908b0df};
-  // Generate N words
-  if (mti >= N) {
-    // Initialize state vector with good enough seed if necessary
-    if (mti == N+1)
-      random_seed((uint32_t)time(NULL));
-    // Modify the state vector accordingly
-    for (size_t i = 0; i < N-M; ++i)
-      y = (mt[i]&UM)|(mt[i+1]&LM), mt[i] = mt[i+M]^(y>>1)^mat[y&(uint32_t)1];
-    for (size_t i = N-M; i < N-1; ++i) {
-      y = (mt[i]&UM)|(mt[i+1]&LM);
-      mt[i] = mt[i+(M-N)]^(y>>1)^mat[y&(uint32_t)1];
+  // Draw from the default generator
+  return random_next(NULL);
+}
+
+double random_real(void) {
+  // Draw from the default generator
+  return random_uniform(NULL);
+}
+
+Random random_create(const uint32_t seed) {
+  // Allocate and seed the generator
+  return random_createkind(RANDOM_KIND,seed);
+}
+
+Random random_createkind(const RandomKind kind, const uint32_t seed) {
+  // Allocate and seed the generator
+  Random rng = MALLOC(sizeof(struct _Random));
+  random_initkind(rng,kind,seed);
+  return rng;
+}
+
+uint32_t random_next(Random rng) {
+  // Step the generator
+  return random_step(random_resolve(rng));
+}
+
+uint64_t random_next64(Random rng) {
+  // Step the generator
+  return random_step64(random_resolve(rng));
+}
+
+double random_uniform(Random rng) {
+  // Scale the highest bits of a number
+  return random_double(random_resolve(rng));
+}
+
+double random_normal(Random rng) {
+  // Build the ziggurats once and sample one
+  rng = random_resolve(rng);
+  pthread_once(&rndzigonce,random_zigset);
+  return random_zignormal(rng,random_step64(rng));
+}
+
+double random_exponential(Random rng) {
+  // Build the ziggurats once and sample one
+  rng = random_resolve(rng);
+  pthread_once(&rndzigonce,random_zigset);
+  return random_zigexp(rng,random_step64(rng));
+}
+
+void random_fillnormal(Random rng, double* buf, const size_t n) {
+  // Draw the numbers of a chunk at once and sample each one
+  rng = random_resolve(rng);
+  pthread_once(&rndzigonce,random_zigset);
+  uint64_t x[RANDOM_CHUNK];
+  for (size_t i = 0, k; i < n; i += k) {
+    k = MIN(n-i,RANDOM_CHUNK);
+    random_fill64(rng,x,k);
+    for (size_t j = 0; j < k; ++j)
+      buf[i+j] = random_zignormal(rng,x[j]);
+  }
+}
+
+void random_fillexponential(Random rng, double* buf, const size_t n) {
+  // Draw the numbers of a chunk at once and sample each one
+  rng = random_resolve(rng);
+  pthread_once(&rndzigonce,random_zigset);
+  uint64_t x[RANDOM_CHUNK];
+  for (size_t i = 0, k; i < n; i += k) {
+    k = MIN(n-i,RANDOM_CHUNK);
+    random_fill64(rng,x,k);
+    for (size_t j = 0; j < k; ++j)
+      buf[i+j] = random_zigexp(rng,x[j]);
+  }
+}
+
+void random_fill(Random rng, uint32_t* buf, const size_t n) {
+  // Step the 64-bit generators in locals
+  rng = random_resolve(rng);
+  if (rng->kind != RANDOM_MT) {
+    random_run(rng,buf,n,32);
+    return;
+  }
+  // Draw the words with the widest registers
+#if RANDOM_X86
+  if (__builtin_cpu_supports("avx2")) {
+    random_drawwide(rng,buf,n);
+    return;
+  }
+#endif // RANDOM_X86
+  random_drawnarrow(rng,buf,n);
+}
+
+void random_fill64(Random rng, uint64_t* buf, const size_t n) {
+  // Step the 64-bit generators in locals
+  rng = random_resolve(rng);
+  if (rng->kind != RANDOM_MT) {
+    random_run(rng,buf,n,64);
+    return;
+  }
+  // Join pairs of words drawn a vector at a time
+  uint32_t w[N];
+  for (size_t i = 0, k; i < n; i += k) {
+    k = MIN(n-i,N/2);
+    random_fill(rng,w,2*k);
+    for (size_t j = 0; j < k; ++j)
+      buf[i+j] = (uint64_t)w[2*j]<<32|w[2*j+1];
+  }
+}
+
+void random_filldouble(Random rng, double* buf, const size_t n) {
+  // Step the 64-bit generators in locals
+  rng = random_resolve(rng);
+  if (rng->kind != RANDOM_MT) {
+    random_run(rng,buf,n,0);
+    return;
+  }
+  // Join the highest bits of pairs of words drawn a vector at a time
+  uint32_t w[N];
+  for (size_t i = 0, k; i < n; i += k) {
+    k = MIN(n-i,N/2);
+    random_fill(rng,w,2*k);
+    for (size_t j = 0; j < k; ++j)
+      buf[i+j] = ((w[2*j]>>5)*67108864.+(w[2*j+1]>>6))*
+      (1./9007199254740992.);
+  }
+}
+
+uint32_t random_below(Random rng, const uint32_t bound) {
+  // Keep a whole number for no bound
+  rng = random_resolve(rng);
+  if (!bound)
+    return random_step(rng);
+  // Scale a number into the range, dividing only if it may be biased
+  uint64_t m = (uint64_t)random_step(rng)*bound;
+  if ((uint32_t)m < bound)
+    m = random_reject(rng,m,bound);
+  return (uint32_t)(m>>32);
+}
+
+uint64_t random_below64(Random rng, const uint64_t bound) {
+  // Keep a whole number for no bound
+  rng = random_resolve(rng);
+  if (!bound)
+    return random_step64(rng);
+  // Scale a number into the range, dividing only if it may be biased
+  RandomWide m = (RandomWide)random_step64(rng)*bound;
+  if ((uint64_t)m < bound)
+    m = random_reject64(rng,m,bound);
+  return (uint64_t)(m>>64);
+}
+
+void random_fillbelow(Random rng, uint32_t* buf, const size_t n,
+const uint32_t bound) {
+  // Keep the numbers whole for no bound
+  rng = random_resolve(rng);
+  if (!bound) {
+    random_fill(rng,buf,n);
+    return;
+  }
+  // Draw the numbers a chunk at a time and scale them with the widest
+  // registers unless any may be biased, which is rare unless bound is large
+  uint32_t t = (uint32_t)-bound%bound;
+  bool (*scale)(uint32_t*,const size_t,const uint32_t,const uint32_t) =
+  random_scalenarrow;
+#if RANDOM_X86
+  if (__builtin_cpu_supports("avx2"))
+    scale = random_scalewide;
+#endif // RANDOM_X86
+  for (size_t i = 0, k; i < n; i += k) {
+    uint32_t* b = buf+i;
+    k = MIN(n-i,RANDOM_CHUNK);
+    random_fill(rng,b,k);
+    // Scale them one by one otherwise, drawing again the biased ones
+    if (!scale(b,k,bound,t))
+      for (size_t j = 0; j < k; ++j) {
+        uint64_t m = (uint64_t)b[j]*bound;
+        b[j] = (uint32_t)((((uint32_t)m < t) ?
+        random_reject(rng,m,bound) : m)>>32);
+      }
+  }
+}
+
+void random_fillbelow64(Random rng, uint64_t* buf, const size_t n,
+const uint64_t bound) {
+  // Draw every number at once, keeping them whole for no bound
+  rng = random_resolve(rng);
+  random_fill64(rng,buf,n);
+  if (!bound)
+    return;
+  // Scale them into the range, drawing again the ones that may be biased
+  uint64_t t = -bound%bound;
+  for (size_t i = 0; i < n; ++i) {
+    RandomWide m = (RandomWide)buf[i]*bound;
+    buf[i] = (uint64_t)((((uint64_t)m < t) ?
+    random_reject64(rng,m,bound) : m)>>64);
+  }
+}
+
+void random_jump(Random rng, const unsigned e) {
+  // Jump with the method of the algorithm of the generator
+  rng = random_resolve(rng);
+  switch (rng->kind) {
+    case RANDOM_XOSHIRO:
+      random_xojump(rng->xs,e);
+      break;
+    case RANDOM_PCG:
+      random_pcgjump(rng,e);
+      break;
+    default:
+      random_mtjump(rng,e);
+  }
+}
+
+Random random_split(Random rng) {
+  // Copy the generator
+  rng = random_resolve(rng);
+  Random child = MALLOC(sizeof(struct _Random));
+  *child = *rng;
+  // Move it past the stream of the copy, or give the copy another stream
+  // of PCG64, whose jumps cannot leave its period, from a new state and
+  // increment drawn from rng
+  if (rng->kind != RANDOM_PCG) {
+    random_jump(rng,RANDOM_JUMP);
+    return child;
+  }
+  uint64_t h[4];
+  for (size_t i = 0; i < 4; ++i)
+    h[i] = random_next64(rng);
+  random_pcgseed(child,random_wide(h),random_wide(h+2));
+  return child;
+}
+
+void random_delete(Random rng) {
+  // Free the generator
+  free(rng);
+}
+
+bool random_secure(void* buf, const size_t len) {
+  // Register the fork handlers once
+  unsigned char* out = buf;
+  random_lock();
+  if (!rndhooked)
+    rndhooked = !pthread_atfork(random_lock,random_unlock,random_forked);
+  // Produce the bytes in pieces that do not cross a reseed
+  bool valid = true;
+  for (size_t done = 0, n; valid && done < len; done += n) {
+    // Draw a key from the system at first, after a fork and periodically
+    if (rndstale || rndbytes >= RANDOM_RESEED) {
+      valid = random_rekey(true);
+      if (valid)
+        rndstale = false, rndbytes = 0;
     }
-    y = (mt[N-1]&UM)|(mt[0]&LM), mt[N-1] = mt[M-1]^(y>>1)^mat[y&(uint32_t)1];
-    mti = 0;
+    // Output the keystream after its first two blocks
+    n = (valid) ? MIN(len-done,RANDOM_RESEED-rndbytes) : 0;
+    random_stream(out+done,n,2), rndbytes += n;
   }
-  y = mt[mti++];
-  // Temper value
-  y ^= (y>>11), y ^= (y<<7)&0x9d2c5680, y ^= (y<<15)&0xefc60000, y ^= (y>>18);
-  // Return random value
-  return y;
+  // Replace the key so that the bytes cannot be recovered from it
+  if (valid && len)
+    random_rekey(false);
+  random_unlock();
+  // Wipe the bytes if any key could not be drawn
+  if (!valid)
+    memset(out,0,len);
+  return valid;
 }
 
-double random_real(void) {
-  // Generate random integer in order to generate a real number
-  uint32_t a = random_int()>>5, b = random_int()>>6;
-  // Return random real
-  return (a*67108864.+b)*(1./9007199254740992.);
+//_____________________________________________________________________________
+
+// ------ AUXILIARIES ------ //
+
+void random_init(Random rng, const uint32_t seed) {
+  // Initialize the generator of the default algorithm
+  random_initkind(rng,RANDOM_KIND,seed);
+}
+
+void random_initkind(Random rng, const RandomKind kind, const uint32_t seed) {
+  // Expand the seed of the 64-bit generators
+  uint64_t x = seed, h[4];
+  rng->kind = kind;
+  if (kind != RANDOM_MT) {
+    for (size_t i = 0; i < 4; ++i)
+      h[i] = random_splitmix(&x);
+    if (kind == RANDOM_XOSHIRO)
+      memcpy(rng->xs,h,sizeof(h));
+    else
+      random_pcgseed(rng,random_wide(h),random_wide(h+2));
+    return;
+  }
+  // Initialize the state vector
+  uint32_t* mt = rng->mt;
+  mt[0] = seed;
+  for (rng->mti = 1; rng->mti < N; ++rng->mti)
+    mt[rng->mti] = 1812433253*(mt[rng->mti-1]^(mt[rng->mti-1]>>30))+
+    (uint32_t)rng->mti;
 }
 
 //_____________________________________________________________________________